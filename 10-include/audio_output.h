@@ -0,0 +1,64 @@
+#pragma once
+#include <SDL2/SDL.h>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libswresample/swresample.h>
+}
+#include <stdint.h>
+
+#include <atomic>
+
+#include "audio_ring.h"
+#include "media_clock.h"
+
+// Device buffer size in sample frames requested from SDL
+#define AUDIO_OUTPUT_SAMPLES 1024
+// Decoded audio buffered ahead of the device, in milliseconds
+#define AUDIO_OUTPUT_FIFO_MS 500
+// Largest resampling correction applied per frame in non audio-master
+// sync modes, in percent
+#define AUDIO_OUTPUT_MAX_COMPENSATION 10
+
+// Decoded audio path: libswresample converts decoder frames to the device
+// format (packed S16 at the device rate and channel count) into an AudioRing,
+// which the SDL audio callback drains without taking a lock. The callback
+// also drives the audio clock from the position it has read up to.
+typedef struct {
+  SDL_AudioDeviceID device;
+  SDL_AudioSpec spec;  // format the device was actually opened with
+  int bytes_per_sample_frame;
+  int bytes_per_sec;
+
+  SwrContext *swr;
+  int in_rate;
+  uint8_t *convert_buf;
+  unsigned int convert_buf_size;
+
+  // Wait-free hand-off between the decode thread and the callback
+  AudioRing ring;
+  // Stream time of byte 0 of the ring, so byte N plays at
+  // pts_origin + N / bytes_per_sec. NAN until the first timestamp.
+  std::atomic<double> pts_origin;
+
+  MediaClock *clock;
+} AudioOutput;
+
+// Open the default output device for the stream decoded by |dec|. Returns 0
+// or a negative AVERROR; on failure the player continues without audio.
+int audio_output_open(AudioOutput *ao, const AVCodecContext *dec,
+                      MediaClock *clock);
+void audio_output_start(AudioOutput *ao);
+
+// Resample |frame| and queue it, waiting while the ring is full. |pts| is the
+// frame start in seconds, NAN to continue from the previous frame.
+int audio_output_write(AudioOutput *ao, const AVFrame *frame, double pts);
+
+// Stretch or shrink the next |nb_samples| input samples so that audio
+// drifts back towards the master clock; |diff| is audio minus master time.
+void audio_output_compensate(AudioOutput *ao, int nb_samples, double diff);
+
+// No more audio will be written; draining the ring is not an underrun.
+void audio_output_finish(AudioOutput *ao);
+void audio_output_abort(AudioOutput *ao);
+void audio_output_close(AudioOutput *ao);
@@ -0,0 +1,88 @@
+#pragma once
+#include <stdint.h>
+
+#include <atomic>
+
+#define AUDIO_RING_CACHELINE 64
+
+// Wait-free single-producer/single-consumer byte ring between a decoder or
+// reader thread and the SDL audio callback. The callback side never takes a
+// lock and never waits: it copies out what is there and pads the rest of the
+// device buffer with silence.
+//
+// head and tail are free-running byte counters, each written by one side
+// only and kept on separate cache lines. The consumer only hands out whole
+// sample frames of |frame_bytes|, so a short read never splits channels.
+typedef struct {
+  uint8_t *buf;
+  unsigned capacity;  // bytes, power of two
+  unsigned mask;
+  unsigned frame_bytes;
+
+  alignas(AUDIO_RING_CACHELINE) std::atomic<unsigned> head;
+  alignas(AUDIO_RING_CACHELINE) std::atomic<unsigned> tail;
+  alignas(AUDIO_RING_CACHELINE) std::atomic<int> finished;
+  std::atomic<int> abort_request;
+  std::atomic<unsigned> rate;  // consumer bytes per second, 0 if unknown
+
+  // Producer side counters
+  std::atomic<uint64_t> written;
+  std::atomic<uint64_t> overruns;  // writes that found the ring full
+  // Consumer side counters
+  std::atomic<uint64_t> read;
+  std::atomic<uint64_t> reads;
+  std::atomic<uint64_t> underruns;
+  std::atomic<uint64_t> underrun_bytes;
+  std::atomic<unsigned> min_fill;  // lowest fill level a read has seen
+} AudioRing;
+
+typedef struct {
+  unsigned capacity;
+  unsigned fill;
+  unsigned min_fill;
+  uint64_t written;
+  uint64_t read;
+  uint64_t reads;
+  uint64_t overruns;
+  uint64_t underruns;
+  uint64_t underrun_bytes;
+} AudioRingStats;
+
+// |capacity| is rounded up to a power of two. Returns 0 or AVERROR(ENOMEM).
+int audio_ring_init(AudioRing *r, unsigned capacity, unsigned frame_bytes);
+void audio_ring_destroy(AudioRing *r);
+
+// Bytes queued for the consumer / room left for the producer.
+unsigned audio_ring_fill(AudioRing *r);
+unsigned audio_ring_space(AudioRing *r);
+
+// Producer side: copy as much of |data| as fits, returns the bytes taken.
+unsigned audio_ring_write(AudioRing *r, const uint8_t *data, unsigned len);
+// Producer side: back off until all of |data| is queued. Returns 0 or
+// AVERROR_EXIT once the ring is aborted.
+int audio_ring_write_all(AudioRing *r, const uint8_t *data, unsigned len);
+// How fast the consumer drains the ring. With it a blocked
+// audio_ring_write_all sleeps until a quarter of the ring is free instead
+// of checking every millisecond.
+void audio_ring_set_rate(AudioRing *r, unsigned bytes_per_sec);
+
+// Consumer side, safe in the audio callback: fill |len| bytes of |dst|,
+// padding with |silence|. Returns the bytes that came from the ring. Coming
+// up short is an underrun unless the producer has finished.
+unsigned audio_ring_read(AudioRing *r, uint8_t *dst, unsigned len,
+                         uint8_t silence);
+
+// Consumer side without the copy: up to |len| bytes, whole frames, that can
+// be read in place as one or two pieces (the second one after the wrap).
+// Returns the total, which stays valid until audio_ring_consume.
+unsigned audio_ring_peek(AudioRing *r, unsigned len, const uint8_t **data1,
+                         unsigned *size1, const uint8_t **data2,
+                         unsigned *size2);
+// Release |n| bytes from the last peek. Getting less than the |wanted|
+// bytes counts the same as a short audio_ring_read.
+void audio_ring_consume(AudioRing *r, unsigned n, unsigned wanted);
+
+// No more data will be written; draining the ring is not an underrun.
+void audio_ring_finish(AudioRing *r);
+void audio_ring_abort(AudioRing *r);
+AudioRingStats audio_ring_stats(AudioRing *r);
@@ -0,0 +1,70 @@
+#pragma once
+#include <SDL2/SDL.h>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+#include <stdint.h>
+
+// Bounded, blocking queues connecting the player pipeline stages.
+//
+// put() blocks while the queue is full so a fast producer is throttled by
+// its consumer (backpressure), get() blocks while it is empty. Items are
+// handed over with av_*_move_ref, the queues own pre-allocated slots and
+// never copy payload data.
+//
+// Return values of put/get:
+//   0             item transferred
+//   AVERROR_EOF   queue finished by the producer and fully drained
+//   AVERROR_EXIT  queue aborted, the caller should stop
+//   AVERROR(EAGAIN) get() timed out
+
+typedef struct {
+  int capacity;
+  int depth;
+  int max_depth;
+  uint64_t pushed;
+  uint64_t full_waits;   // put() had to wait for the consumer
+  uint64_t empty_waits;  // get() had to wait for the producer
+} QueueStats;
+
+typedef struct {
+  AVPacket **pkts;
+  int read_index;
+  int finished;
+  int abort_request;
+  QueueStats stats;
+  SDL_mutex *mutex;
+  SDL_cond *cond;
+} PacketQueue;
+
+typedef struct {
+  AVFrame **frames;
+  int read_index;
+  int finished;
+  int abort_request;
+  QueueStats stats;
+  SDL_mutex *mutex;
+  SDL_cond *cond;
+} FrameQueue;
+
+int packet_queue_init(PacketQueue *q, int capacity);
+void packet_queue_destroy(PacketQueue *q);
+// Takes over the reference held by |pkt|, which is left blank.
+int packet_queue_put(PacketQueue *q, AVPacket *pkt);
+// timeout_ms < 0 waits indefinitely.
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, int timeout_ms);
+// No more packets will be put; get() returns AVERROR_EOF once drained.
+void packet_queue_finish(PacketQueue *q);
+void packet_queue_abort(PacketQueue *q);
+QueueStats packet_queue_stats(PacketQueue *q);
+
+int frame_queue_init(FrameQueue *q, int capacity);
+void frame_queue_destroy(FrameQueue *q);
+int frame_queue_put(FrameQueue *q, AVFrame *frame);
+int frame_queue_get(FrameQueue *q, AVFrame *frame, int timeout_ms);
+void frame_queue_finish(FrameQueue *q);
+void frame_queue_abort(FrameQueue *q);
+QueueStats frame_queue_stats(FrameQueue *q);
+
+void queue_stats_print(const char *name, const QueueStats *stats);
@@ -0,0 +1,17 @@
+#pragma once
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+typedef struct {
+  int upload;  // also upload every frame to an SDL texture
+} DecodeBenchOptions;
+
+// Headless throughput run of the video path: demux, decode and convert as
+// fast as possible with no window and no pacing, optionally followed by the
+// texture upload on SDL's dummy video driver. Prints frames/s, MB/s,
+// per-stage latency percentiles and peak RSS. Returns 0 or a negative
+// AVERROR.
+int decode_bench_run(const DecodeBenchOptions *opts, AVFormatContext *fmt_ctx,
+                     AVCodecContext *dec_ctx, int stream_index);
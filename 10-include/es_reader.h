@@ -0,0 +1,58 @@
+#pragma once
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+#include <stddef.h>
+#include <stdint.h>
+
+#define ES_READER_DEFAULT_BUFFER (4 << 20)
+#define ES_READER_MIN_BUFFER (64 << 10)
+// The end of a mapped file is copied into a padded buffer, reading past it
+// could cross into an unmapped page
+#define ES_READER_MMAP_TAIL 4096
+
+typedef enum {
+  ES_READER_READ,  // read() into one reused buffer
+  ES_READER_MMAP,  // windows straight out of a read-only mapping
+} EsReaderMode;
+
+// Elementary-stream input for av_parser_parse2. The file is handed out in
+// large windows that are always followed by at least
+// AV_INPUT_BUFFER_PADDING_SIZE readable bytes, zeros at the end of the
+// file. The parser keeps any incomplete frame internally, so each window
+// can be consumed completely and nothing is ever moved back to the start of
+// the buffer.
+//
+// In mmap mode the windows are zero-copy views of the file: the bytes that
+// follow a window are simply the next ones in the mapping, and only the
+// last ES_READER_MMAP_TAIL bytes go through a copy to get their padding.
+typedef struct {
+  EsReaderMode mode;
+  int fd;
+  uint8_t *buf;  // read mode window, mmap mode tail
+  size_t buf_size;
+
+  uint8_t *map;
+  size_t map_size;
+  size_t map_pos;
+
+  uint64_t bytes;
+  uint64_t reads;  // read calls, or windows handed out of the mapping
+  int64_t read_us;
+} EsReader;
+
+const char *es_reader_mode_name(EsReaderMode mode);
+int es_reader_parse_mode(const char *name, EsReaderMode *mode);
+
+// |buf_size| 0 selects ES_READER_DEFAULT_BUFFER. ES_READER_MMAP falls back
+// to read() for inputs that cannot be mapped (pipes, empty files). Returns 0
+// or a negative AVERROR.
+int es_reader_open(EsReader *r, const char *path, size_t buf_size,
+                   EsReaderMode mode);
+
+// Next window of the file in |*data|/|*size|. Returns 1, 0 at end of file
+// or a negative AVERROR. The window stays valid until the next call.
+int es_reader_next(EsReader *r, const uint8_t **data, size_t *size);
+
+void es_reader_close(EsReader *r);
+void es_reader_print_stats(const EsReader *r);
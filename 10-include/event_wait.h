@@ -0,0 +1,53 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdint.h>
+
+// Longest single sleep. SDL only turns SIGINT / SIGTERM into SDL_QUIT when
+// events are pumped, so an idle loop still looks once a second.
+#define EVENT_WAIT_MAX_MS 1000
+
+// Blocking wait for the tools' main loops, counting how often the loop
+// really wakes up so an idle player can be checked to use no CPU. Worker
+// threads wake the loop by posting a user event instead of the loop polling
+// their state.
+//
+// With the video subsystem up, SDL_WaitEventTimeout sleeps in the window
+// system until an event arrives or one is pushed. Without it SDL 2 polls
+// internally every millisecond, so audio-only tools sleep on a semaphore
+// instead, which an event watch posts for every event pushed from any
+// thread.
+typedef struct {
+  SDL_sem *sem;  // NULL when SDL_WaitEventTimeout blocks properly
+  Uint32 start_ms;
+  uint64_t wakeups;   // returns from a sleep
+  uint64_t timeouts;  // ... that found no event
+} EventWait;
+
+typedef struct {
+  double seconds;
+  uint64_t wakeups;
+  uint64_t timeouts;
+  double wakeups_per_sec;
+} EventWaitStats;
+
+// After SDL_Init. Returns 0 or AVERROR(ENOMEM).
+int event_wait_init(EventWait *w);
+void event_wait_close(EventWait *w);
+
+// Wait up to |timeout_ms| (< 0 as long as it takes, 0 just polls) for the
+// next event. Returns 1 with |*event| filled, or 0 when none came; sleeps
+// are capped at EVENT_WAIT_MAX_MS, so 0 can come early.
+int event_wait(EventWait *w, SDL_Event *event, int timeout_ms);
+
+// Shorten |*timeout_ms| (< 0 for none yet) so the wait ends by
+// |deadline_ms|, an SDL_GetTicks() time.
+void event_wait_until(int *timeout_ms, Uint32 deadline_ms);
+
+// A user event type for a worker to wake the loop with, (Uint32)-1 when SDL
+// has run out of them.
+Uint32 event_wait_register(void);
+// Any thread.
+void event_wait_post(Uint32 type, int code);
+
+EventWaitStats event_wait_stats(EventWait *w);
+void event_wait_print_stats(EventWait *w, const char *name);
@@ -0,0 +1,63 @@
+#pragma once
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#include <libswscale/swscale.h>
+}
+#include <stdint.h>
+
+// Number of output buffers handed out round-robin by the converter
+#define FRAME_CONVERTER_POOL_SIZE 3
+// Row alignment of the pooled buffers, wide enough for AVX2 loads
+#define FRAME_CONVERTER_ALIGN 32
+
+typedef struct {
+  uint8_t *data[4];
+  int linesize[4];
+} ConverterBuffer;
+
+// Persistent pixel format / size conversion stage.
+//
+// The SwsContext is keyed on (src size, src format, dst size, dst format) and
+// the output buffers are allocated once per geometry, so the steady state
+// per-frame cost is a single sws_scale call.
+typedef struct {
+  struct SwsContext *sws_ctx;
+
+  // Geometry the scaler and the pool were built for
+  int src_w;
+  int src_h;
+  AVPixelFormat src_fmt;
+  int dst_w;
+  int dst_h;
+  AVPixelFormat dst_fmt;
+
+  ConverterBuffer pool[FRAME_CONVERTER_POOL_SIZE];
+  int pool_next;
+
+  // Frame counters and timings, times in microseconds
+  uint64_t frames;
+  uint64_t passthrough;
+  uint64_t rebuilds;
+  int64_t convert_us_total;
+  int64_t convert_us_max;
+  int64_t rebuild_us_total;
+} FrameConverter;
+
+void frame_converter_init(FrameConverter *conv);
+
+// Convert |frame| to dst_w x dst_h in dst_fmt. On success |out| points at a
+// pooled buffer which stays valid until FRAME_CONVERTER_POOL_SIZE further
+// conversions or the next geometry change. Returns 0 or a negative AVERROR.
+int frame_converter_convert(FrameConverter *conv, const AVFrame *frame,
+                            int dst_w, int dst_h, AVPixelFormat dst_fmt,
+                            ConverterBuffer **out);
+
+// Returns 1 when |frame| is already in the destination layout and can be
+// uploaded from frame->data directly, counting it as a zero-copy frame.
+int frame_converter_passthrough(FrameConverter *conv, const AVFrame *frame,
+                                int dst_w, int dst_h, AVPixelFormat dst_fmt);
+
+void frame_converter_print_stats(const FrameConverter *conv);
+
+void frame_converter_free(FrameConverter *conv);
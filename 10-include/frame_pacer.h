@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+
+// Time spun before a deadline instead of slept, absorbing the scheduler's
+// wake-up latency. clock_nanosleep usually wakes within tens of
+// microseconds, SDL_Delay only has millisecond granularity.
+#ifdef __linux__
+#define FRAME_PACER_DEFAULT_SPIN 0.0002
+#else
+#define FRAME_PACER_DEFAULT_SPIN 0.002
+#endif
+
+#define FRAME_PACER_HISTOGRAM_BUCKETS 10
+
+// Sub-millisecond frame scheduling on SDL_GetPerformanceCounter. Deadlines
+// are absolute times in seconds on frame_pacer_now(), so rounding never
+// accumulates from frame to frame.
+typedef struct {
+  double spin_margin;  // seconds, 0 disables spinning
+  uint64_t waits;
+  uint64_t late;  // deadline had already passed when the wait started
+  double error_sum;
+  double max_error;
+  // Wake-up error (actual - deadline) distribution, see bucket limits in
+  // frame_pacer.cpp
+  uint64_t histogram[FRAME_PACER_HISTOGRAM_BUCKETS];
+} FramePacer;
+
+double frame_pacer_now(void);
+
+void frame_pacer_init(FramePacer *p, double spin_margin);
+
+// Block until |deadline| and record how precisely it was hit.
+void frame_pacer_wait_until(FramePacer *p, double deadline);
+
+void frame_pacer_print_stats(const FramePacer *p);
@@ -0,0 +1,66 @@
+#pragma once
+#include <SDL2/SDL.h>
+extern "C" {
+#include <libavutil/frame.h>
+}
+#include <stdint.h>
+
+#include <atomic>
+
+#include "av_queue.h"
+
+#define FRAME_RING_CACHELINE 64
+
+// Lock-free single-producer/single-consumer ring of pre-allocated AVFrame
+// slots. Frames are handed over with av_frame_move_ref, so only the buffer
+// references change hands and no pixel data is copied.
+//
+// Exactly one thread may push and exactly one thread may pop. The head index
+// is only written by the producer and the tail index only by the consumer;
+// they live on separate cache lines to avoid false sharing.
+//
+// A side that finds the ring full / empty raises its waiting flag and sleeps
+// on a semaphore. The other side posts it only when it sees the flag, i.e.
+// on the full -> not full and empty -> not empty transitions, so the hand-off
+// costs one fence per frame and no system call while neither side waits.
+//
+// Return values follow the PacketQueue / FrameQueue conventions.
+typedef struct {
+  AVFrame **slots;
+  unsigned capacity;  // power of two
+  unsigned mask;
+
+  SDL_sem *not_full;   // posted for a waiting producer
+  SDL_sem *not_empty;  // posted for a waiting consumer
+
+  alignas(FRAME_RING_CACHELINE) std::atomic<unsigned> head;
+  std::atomic<int> consumer_waiting;
+  alignas(FRAME_RING_CACHELINE) std::atomic<unsigned> tail;
+  std::atomic<int> producer_waiting;
+  alignas(FRAME_RING_CACHELINE) std::atomic<int> finished;
+  std::atomic<int> abort_request;
+
+  // Producer side counters
+  std::atomic<uint64_t> pushed;
+  std::atomic<uint64_t> full_waits;
+  std::atomic<int> max_depth;
+  // Consumer side counters
+  std::atomic<uint64_t> empty_waits;
+} FrameRing;
+
+// |capacity| is rounded up to a power of two. Returns 0 or AVERROR(ENOMEM).
+int frame_ring_init(FrameRing *r, unsigned capacity);
+void frame_ring_destroy(FrameRing *r);
+
+// Non-blocking hand-off, AVERROR(EAGAIN) when full / empty.
+int frame_ring_try_push(FrameRing *r, AVFrame *frame);
+int frame_ring_try_pop(FrameRing *r, AVFrame *frame);
+
+// Producer side: block until a slot frees up or the ring is aborted.
+int frame_ring_push(FrameRing *r, AVFrame *frame);
+// Consumer side: wait up to |timeout_ms| (< 0 forever) for a frame.
+int frame_ring_pop(FrameRing *r, AVFrame *frame, int timeout_ms);
+
+void frame_ring_finish(FrameRing *r);
+void frame_ring_abort(FrameRing *r);
+QueueStats frame_ring_stats(FrameRing *r);
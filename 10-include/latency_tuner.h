@@ -0,0 +1,91 @@
+#pragma once
+#include <stdint.h>
+
+#include <atomic>
+
+// Device period range the tuner moves in, powers of two in sample frames
+#define LATENCY_TUNER_MIN_SAMPLES 64
+#define LATENCY_TUNER_MAX_SAMPLES 8192
+// Callback timing is judged over windows of this length
+#define LATENCY_TUNER_WINDOW_MS 2000
+// Clean windows needed before trying a smaller period; doubles with every
+// grow so a period that glitched is not retried right away
+#define LATENCY_TUNER_SHRINK_WINDOWS 3
+#define LATENCY_TUNER_MAX_SHRINK_WINDOWS 48
+// Callbacks right after a (re)open come in a burst while SDL primes the
+// device, their intervals say nothing about steady state
+#define LATENCY_TUNER_WARMUP_CALLBACKS 4
+
+// Measures how regularly the SDL audio callback runs and, in adaptive mode,
+// picks the device period: it starts at the largest period that fits the
+// target latency, doubles it after a window with underruns or with
+// callback jitter above half a period, and halves it again after enough
+// clean windows while the estimated latency is above target.
+//
+// The device can only change its period by being reopened, so the tuner
+// only proposes a size; the owner reopens and reports back what it got.
+//
+// The callback side is wait-free: it timestamps itself and updates a few
+// atomics. Everything else runs on the main thread.
+typedef struct {
+  int freq;
+  int target_ms;
+  int adaptive;
+  int samples;  // current device period
+
+  // Callback side
+  std::atomic<uint64_t> last_ticks;  // performance counter, 0 after reopen
+  std::atomic<int> warmup;
+  std::atomic<uint64_t> callbacks;
+  std::atomic<uint64_t> intervals;
+  std::atomic<uint64_t> jitter_sum_us;
+  std::atomic<uint64_t> window_jitter_max_us;  // reset by every update
+
+  // Main thread side
+  uint32_t window_start_ms;
+  uint64_t window_underruns;  // underrun count when the window started
+  int clean_windows;
+  int shrink_windows;
+  uint64_t jitter_max_us;
+  int grows;
+  int shrinks;
+} LatencyTuner;
+
+typedef struct {
+  int samples;
+  double period_ms;
+  double latency_ms;  // estimated output latency
+  int target_ms;
+  double jitter_avg_ms;  // mean |interval - period| since start
+  double jitter_max_ms;
+  uint64_t callbacks;
+  int grows;
+  int shrinks;
+} LatencyStats;
+
+// Returns the period to open the device with: in adaptive mode the largest
+// one whose estimated latency fits |target_ms|, else |samples|. |freq| may
+// be 0 if the rate is only known once the device is open; |samples| is
+// returned as is then.
+int latency_tuner_init(LatencyTuner *t, int freq, int samples, int target_ms,
+                       int adaptive);
+
+// The device was (re)opened at |freq| Hz with |samples| per callback, as
+// the obtained spec says, before it starts.
+void latency_tuner_set_period(LatencyTuner *t, int freq, int samples);
+
+// Audio callback side, first thing in the callback.
+void latency_tuner_on_callback(LatencyTuner *t);
+
+// Main thread, called regularly with the total underrun count so far.
+// Returns the period to reopen the device with, or 0 to keep it.
+int latency_tuner_update(LatencyTuner *t, uint64_t underruns);
+// SDL_GetTicks() time the current window ends, the next update that does
+// anything.
+uint32_t latency_tuner_deadline(LatencyTuner *t);
+
+// One period queued in the device while the next one is being filled.
+double latency_tuner_latency_ms(int samples, int freq);
+
+LatencyStats latency_tuner_stats(LatencyTuner *t);
+void latency_tuner_print_stats(LatencyTuner *t);
@@ -0,0 +1,20 @@
+#pragma once
+#include <SDL2/SDL.h>
+
+// A presentation clock: the stream time it was last set to plus the wall
+// time elapsed since. Written by one thread (e.g. the audio callback) and
+// read by others, guarded by a spinlock since updates are a few stores.
+typedef struct {
+  double pts;           // stream time at last_updated, in seconds
+  double last_updated;  // system time of the last update, in seconds
+  SDL_SpinLock lock;
+} MediaClock;
+
+// Monotonic system time in seconds
+double media_clock_now(void);
+
+// Starts out unset, media_clock_get() returns NAN until the first set.
+void media_clock_init(MediaClock *c);
+void media_clock_set(MediaClock *c, double pts);
+void media_clock_set_at(MediaClock *c, double pts, double time);
+double media_clock_get(MediaClock *c);
@@ -0,0 +1,47 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdint.h>
+
+// Packed signed 16-bit PCM to whatever sample format and channel count an
+// audio device was opened with, so the conversion happens in batches on the
+// reader thread instead of inside SDL's audio thread.
+//
+// Channels are remapped first in the s16 domain (stereo <-> mono, extra
+// device channels left silent), then every sample is converted on its own,
+// which is where the SSE2 / AVX2 kernels come in. Sample rate conversion is
+// not done here.
+typedef void (*PcmConvertFunc)(uint8_t *dst, const int16_t *src, int count);
+
+typedef struct {
+  int src_channels;
+  int dst_channels;
+  SDL_AudioFormat dst_format;
+  int src_frame_bytes;
+  int dst_frame_bytes;
+
+  PcmConvertFunc convert;  // NULL when the device takes s16 as is
+  const char *kernel;      // "c", "sse2" or "avx2"
+
+  int16_t *remix_buf;  // s16 at the device channel count
+  unsigned int remix_buf_size;
+} PcmConvert;
+
+// Kernel turning |count| s16 samples into |format| allowed by |cpu_flags|
+// (AV_CPU_FLAG_* bits, 0 for the scalar code), NULL if |format| is not
+// supported. |*name| is set to "c", "sse2" or "avx2" if not NULL.
+PcmConvertFunc pcm_convert_get(SDL_AudioFormat format, int cpu_flags,
+                               const char **name);
+
+// Returns 0, or AVERROR(ENOSYS) when the device format is not one of the
+// native-endian s16 / s32 / f32 / u8 / s8 formats.
+int pcm_convert_init(PcmConvert *c, int src_channels,
+                     const SDL_AudioSpec *device, int cpu_flags);
+
+// Convert |nb_frames| sample frames; |dst| holds nb_frames * dst_frame_bytes.
+int pcm_convert_run(PcmConvert *c, uint8_t *dst, const uint8_t *src,
+                    int nb_frames);
+
+// Nothing to do, the file bytes can go to the device unchanged.
+int pcm_convert_is_passthrough(const PcmConvert *c);
+const char *pcm_convert_format_name(SDL_AudioFormat format);
+void pcm_convert_free(PcmConvert *c);
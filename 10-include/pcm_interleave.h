@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+
+// Planar to interleaved PCM: |src[ch]| holds |nb_samples| samples of
+// |sample_size| bytes for each of |channels| planes, |dst| receives them
+// interleaved. The copy only depends on the sample size, so one kernel
+// serves u8 (1), s16 (2), s32 and flt (4) and dbl (8).
+//
+// Mono is a plain copy and stereo has SSE2 / AVX2 kernels; other channel
+// counts use the scalar loop.
+typedef void (*PcmInterleaveFunc)(uint8_t *dst, const uint8_t *const *src,
+                                  int channels, int nb_samples,
+                                  int sample_size);
+
+// Best implementation allowed by |cpu_flags| (AV_CPU_FLAG_* bits, 0 for
+// the scalar code). |*name| is set to "c", "sse2" or "avx2" if not NULL.
+PcmInterleaveFunc pcm_interleave_get(int cpu_flags, const char **name);
+
+// Interleave with the best implementation for this CPU.
+void pcm_interleave(uint8_t *dst, const uint8_t *const *src, int channels,
+                    int nb_samples, int sample_size);
@@ -0,0 +1,82 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "audio_ring.h"
+
+#define PCM_MIXER_MAX_STREAMS 64
+// s16 gains are Q15, this is 1.0 and skips the multiply
+#define PCM_MIXER_UNITY_Q15 32768
+
+// Sums |count| samples of |src| scaled by |gain| into |dst|. s16 saturates
+// on every add, f32 accumulates and is clamped once after the last stream.
+typedef void (*PcmMixS16Func)(int16_t *dst, const int16_t *src, int count,
+                              int gain_q15);
+typedef void (*PcmMixF32Func)(float *dst, const float *src, int count,
+                              float gain);
+typedef void (*PcmClampF32Func)(float *dst, int count);
+
+typedef struct {
+  PcmMixS16Func mix_s16;
+  PcmMixF32Func mix_f32;
+  PcmClampF32Func clamp_f32;
+  const char *name;  // "c", "ssse3" or "avx2"
+} PcmMixKernels;
+
+typedef struct {
+  AudioRing *ring;
+  std::atomic<float> gain;  // 0 keeps draining the ring but adds nothing
+} PcmMixerInput;
+
+// Plays any number of PCM streams through one audio device: every stream
+// has its own AudioRing filled by its own producer, and the audio callback
+// sums whatever each ring holds straight out of the ring into the device
+// buffer. All streams share the device format, s16 or f32 native-endian.
+//
+// The callback side never allocates, locks or waits. Inputs are added from
+// the main thread only, each one published with a release store of the
+// count; gains are clamped to [0, 1] and can change at any time.
+typedef struct {
+  SDL_AudioFormat format;
+  int channels;
+  int frame_bytes;
+  PcmMixKernels kernels;
+
+  PcmMixerInput inputs[PCM_MIXER_MAX_STREAMS];
+  std::atomic<int> nb_inputs;
+
+  // Callback side: time spent mixing, in performance counter ticks
+  std::atomic<uint64_t> mixes;
+  std::atomic<uint64_t> mix_ticks;
+  std::atomic<uint64_t> mix_ticks_max;
+} PcmMixer;
+
+typedef struct {
+  int inputs;
+  uint64_t mixes;
+  double mix_avg_us;
+  double mix_max_us;
+  uint64_t underruns;  // summed over the input rings
+} PcmMixerStats;
+
+// Kernels allowed by |cpu_flags| (AV_CPU_FLAG_* bits, 0 for the scalar
+// code).
+void pcm_mixer_get_kernels(int cpu_flags, PcmMixKernels *k);
+
+// Returns 0, or AVERROR(ENOSYS) when |format| is not AUDIO_S16SYS or
+// AUDIO_F32SYS.
+int pcm_mixer_init(PcmMixer *m, SDL_AudioFormat format, int channels,
+                   int cpu_flags);
+
+// Main thread: |ring| must carry frames in the mixer's format and outlive
+// the mixer. Returns the input index, or AVERROR(ENOSPC) when full.
+int pcm_mixer_add(PcmMixer *m, AudioRing *ring, float gain);
+void pcm_mixer_set_gain(PcmMixer *m, int index, float gain);
+
+// Audio callback: fill |len| bytes of |dst| with the sum of all inputs.
+void pcm_mixer_mix(PcmMixer *m, uint8_t *dst, int len);
+
+PcmMixerStats pcm_mixer_stats(PcmMixer *m);
+void pcm_mixer_print_stats(PcmMixer *m);
@@ -0,0 +1,77 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "audio_ring.h"
+#include "es_reader.h"
+#include "pcm_convert.h"
+
+// Ring buffer between the reader thread and the audio callback
+#define PCM_STREAM_DEFAULT_RING (512 << 10)
+#define PCM_STREAM_MIN_RING (16 << 10)
+// File windows the reader thread copies into the ring
+#define PCM_STREAM_READ_WINDOW ES_READER_MIN_BUFFER
+// Largest file sample frame a window boundary can split
+#define PCM_STREAM_MAX_FRAME 64
+
+// Raw PCM played straight off disk. A reader thread pulls the file through
+// an EsReader (read() windows or an mmap) into a fixed-size AudioRing ahead
+// of the SDL audio callback, so memory use is bounded by the ring and
+// playback can start as soon as the first part of the file is in.
+//
+// The callback side is the ring's wait-free consumer: it never locks or
+// blocks on I/O, whatever the ring holds is copied out and the rest of the
+// device buffer is filled with silence and counted as an underrun.
+//
+// When the device format differs from the file, the reader thread converts
+// each window with a PcmConvert before queueing it, so the ring always holds
+// device-ready samples and SDL has nothing left to convert.
+typedef struct {
+  char *path;
+  EsReaderMode mode;
+  int loop;         // rewind at end of file instead of finishing
+  int frame_bytes;  // device sample frame, the callback only takes whole ones
+  Uint8 silence;
+  Uint32 eof_event;  // pushed once the reader is done, 0 for none
+
+  PcmConvert *convert;  // NULL or pass-through: file bytes go in as they are
+  uint8_t *convert_buf;
+  int convert_frames;  // capacity of convert_buf in sample frames
+  uint8_t carry[PCM_STREAM_MAX_FRAME];  // file frame split across windows
+  int carry_bytes;
+
+  EsReader reader;
+  SDL_Thread *thread;
+  AudioRing ring;
+
+  // Reader side counters
+  std::atomic<uint64_t> loops;
+} PcmStream;
+
+typedef struct {
+  uint64_t loops;
+  AudioRingStats ring;
+} PcmStreamStats;
+
+// |ring_size| 0 selects PCM_STREAM_DEFAULT_RING, it is rounded up to a power
+// of two. Starts the reader thread and waits until half the ring (or the
+// whole file) is buffered. |frame_bytes| is the device sample frame;
+// |convert|, if not NULL, must outlive the stream. |eof_event|, if not 0, is
+// posted (see event_wait_post) when the reader has queued its last byte.
+// Returns 0 or a negative AVERROR.
+int pcm_stream_open(PcmStream *s, const char *path, EsReaderMode mode,
+                    int ring_size, int frame_bytes, PcmConvert *convert,
+                    Uint8 silence, int loop, Uint32 eof_event);
+
+// Audio callback side: fill |len| bytes of |dst|. Returns the number of
+// bytes that came from the file, the rest is silence.
+int pcm_stream_read(PcmStream *s, uint8_t *dst, int len);
+
+// A non-looping stream has played its last byte.
+int pcm_stream_finished(PcmStream *s);
+
+PcmStreamStats pcm_stream_stats(PcmStream *s);
+void pcm_stream_print_stats(PcmStream *s);
+void pcm_stream_close(PcmStream *s);
@@ -0,0 +1,32 @@
+#pragma once
+
+// Shared setup for the PCM kernels that pick a SIMD implementation at run
+// time (pcm_interleave, pcm_convert, pcm_mixer).
+//
+// Every kernel family has a scalar *_tail loop that starts at sample
+// |start|: from 0 it is the C kernel, and the SIMD kernels call it to finish
+// the samples left over after their last full register.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// Kernels beyond SSE2 are compiled for their target only, so the rest of
+// the file still runs on any x86 CPU, and picked from the AV_CPU_FLAG_*
+// bits at run time.
+#if SIMD_X86 && defined(__GNUC__)
+#define SIMD_TARGETS 1
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define SIMD_MAX_LEVELS 4
+
+// Returns the name of the kernel a *_get function picks for |cpu_flags|.
+typedef const char *(*SimdKernelName)(int cpu_flags);
+
+// For benchmarks: fills |flags| with the cpu flag sets from the scalar
+// kernels up to everything this CPU supports, keeping one set per distinct
+// kernel |kernel_name| reports. Returns the number of sets.
+int simd_bench_levels(SimdKernelName kernel_name,
+                      int flags[SIMD_MAX_LEVELS]);
@@ -0,0 +1,113 @@
+#pragma once
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+}
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of the staging block rows are coalesced into before hitting the
+// disk. A multiple of YUV_WRITER_ALIGN so every full block can go out with
+// O_DIRECT.
+#define YUV_WRITER_BLOCK_SIZE (4 << 20)
+#define YUV_WRITER_ALIGN 4096
+// Upper bound of iovecs gathered into one writev call
+#define YUV_WRITER_MAX_IOV 1024
+
+typedef enum {
+  YUV_WRITER_BUFFERED,  // copy rows into aligned blocks, one write per block
+  YUV_WRITER_DIRECT,    // same blocks, written with O_DIRECT
+  YUV_WRITER_WRITEV,    // no copy, gather plane rows straight from the frame
+} YuvWriterMode;
+
+typedef enum {
+  YUV_WRITER_FORMAT_RAW,   // headerless planes in the decoder's format
+  YUV_WRITER_FORMAT_NV12,  // headerless, 4:2:0 chroma interleaved as NV12
+  YUV_WRITER_FORMAT_Y4M,   // YUV4MPEG2 stream header plus FRAME markers
+} YuvWriterFormat;
+
+// Sidecar frame index: a YuvIndexHeader followed by one fixed-size
+// YuvIndexEntry per frame, so frame N is found at a known file position.
+// Fields are stored in host byte order.
+#define YUV_INDEX_MAGIC "YUVIDX01"
+#define YUV_INDEX_KEYFRAME 1
+
+typedef struct {
+  char magic[8];
+  int32_t width;
+  int32_t height;
+  char pix_fmt[16];  // layout of the written pictures, e.g. "nv12"
+  int32_t time_base_num;
+  int32_t time_base_den;
+  uint32_t entry_size;
+  uint32_t reserved;
+} YuvIndexHeader;
+
+typedef struct {
+  uint64_t offset;  // first picture byte, past any Y4M FRAME marker
+  int64_t pts;      // in the header time base, INT64_MIN when unknown
+  uint32_t size;    // picture bytes
+  uint32_t flags;   // YUV_INDEX_KEYFRAME
+} YuvIndexEntry;
+
+typedef struct {
+  YuvWriterFormat format;
+  AVRational frame_rate;           // Y4M header, 25 fps when unknown
+  AVRational sample_aspect_ratio;  // Y4M header, 0:0 when unknown
+  AVRational time_base;            // of frame->pts, for the index
+  int stream_header;  // 0 leaves out the Y4M stream header (continuation)
+  const char *index_path;  // NULL writes no index
+} YuvWriterOptions;
+
+struct iovec;
+
+// Raw planar/semi-planar video dump that honours each plane's linesize, so
+// padded frames come out as tightly packed pictures. Bypasses stdio: output
+// goes through large aligned blocks or writev, which keeps 4K dumps at disk
+// bandwidth instead of three small fwrite calls per frame.
+typedef struct {
+  int fd;
+  YuvWriterMode mode;
+
+  uint8_t *block;
+  size_t block_used;
+
+  struct iovec *iov;
+  int iov_count;
+
+  YuvWriterOptions opts;
+  int header_written;
+  uint64_t offset;  // output bytes so far, including Y4M markers
+  uint8_t *nv12_chroma;
+  unsigned int nv12_chroma_size;
+  FILE *index;
+
+  uint64_t frames;
+  uint64_t bytes;
+  uint64_t syscalls;
+  int64_t write_us;
+} YuvWriter;
+
+const char *yuv_writer_mode_name(YuvWriterMode mode);
+int yuv_writer_parse_mode(const char *name, YuvWriterMode *mode);
+
+// Create or truncate |path|. YUV_WRITER_DIRECT falls back to buffered
+// output when the filesystem refuses O_DIRECT. Returns 0 or a negative
+// AVERROR.
+int yuv_writer_open(YuvWriter *w, const char *path, YuvWriterMode mode);
+
+// Select the output layout and optional index; call before the first frame.
+// Without it frames are written raw and unindexed.
+void yuv_writer_options_default(YuvWriterOptions *opts);
+int yuv_writer_configure(YuvWriter *w, const YuvWriterOptions *opts);
+int yuv_writer_parse_format(const char *name, YuvWriterFormat *format);
+
+// Append the visible picture of |frame|, plane after plane, and its index
+// entry.
+int yuv_writer_write_frame(YuvWriter *w, const AVFrame *frame);
+
+// Write out the partial last block and close the file.
+int yuv_writer_close(YuvWriter *w);
+
+void yuv_writer_print_stats(const YuvWriter *w);
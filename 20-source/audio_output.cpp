@@ -0,0 +1,153 @@
+#include "audio_output.h"
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/samplefmt.h>
+}
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static void SDLCALL audio_callback(void *opaque, Uint8 *stream, int len) {
+  AudioOutput *ao = (AudioOutput *)opaque;
+  double now = media_clock_now();
+
+  unsigned n = audio_ring_read(&ao->ring, stream, len, ao->spec.silence);
+  double origin = ao->pts_origin.load(std::memory_order_acquire);
+
+  // The read position is what reaches the speakers next, after the buffer
+  // just handed to SDL and roughly one more device buffer
+  if (n > 0 && !isnan(origin)) {
+    uint64_t read = ao->ring.read.load(std::memory_order_relaxed);
+    double latency = (double)(len + ao->spec.size) / ao->bytes_per_sec;
+    media_clock_set_at(ao->clock,
+                       origin + (double)read / ao->bytes_per_sec - latency, now);
+  }
+}
+
+int audio_output_open(AudioOutput *ao, const AVCodecContext *dec,
+                      MediaClock *clock) {
+  SDL_AudioSpec wanted;
+  AVChannelLayout out_layout;
+  int ret;
+
+  ao->device = 0;
+  ao->bytes_per_sample_frame = 0;
+  ao->bytes_per_sec = 0;
+  ao->swr = NULL;
+  ao->convert_buf = NULL;
+  ao->convert_buf_size = 0;
+  ao->ring.buf = NULL;
+  ao->pts_origin.store(NAN);
+  ao->clock = clock;
+  ao->in_rate = dec->sample_rate;
+
+  SDL_zero(wanted);
+  wanted.freq = dec->sample_rate;
+  wanted.format = AUDIO_S16SYS;
+  wanted.channels = dec->ch_layout.nb_channels;
+  wanted.samples = AUDIO_OUTPUT_SAMPLES;
+  wanted.callback = audio_callback;
+  wanted.userdata = ao;
+  ao->device = SDL_OpenAudioDevice(
+      NULL, 0, &wanted, &ao->spec,
+      SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+  if (!ao->device) {
+    fprintf(stderr, "Couldn't open audio: %s\n", SDL_GetError());
+    audio_output_close(ao);
+    return AVERROR(ENODEV);
+  }
+  ao->bytes_per_sample_frame = ao->spec.channels * 2;
+  ao->bytes_per_sec = ao->spec.freq * ao->bytes_per_sample_frame;
+
+  av_channel_layout_default(&out_layout, ao->spec.channels);
+  ret = swr_alloc_set_opts2(&ao->swr, &out_layout, AV_SAMPLE_FMT_S16,
+                            ao->spec.freq, &dec->ch_layout, dec->sample_fmt,
+                            dec->sample_rate, 0, NULL);
+  av_channel_layout_uninit(&out_layout);
+  if (ret < 0 || (ret = swr_init(ao->swr)) < 0) {
+    fprintf(stderr, "Could not create audio resampler\n");
+    audio_output_close(ao);
+    return ret;
+  }
+
+  int ring_size = ao->bytes_per_sec / 1000 * AUDIO_OUTPUT_FIFO_MS;
+  if (ring_size < 4 * (int)ao->spec.size) {
+    ring_size = 4 * ao->spec.size;
+  }
+  if (audio_ring_init(&ao->ring, ring_size, ao->bytes_per_sample_frame) < 0) {
+    audio_output_close(ao);
+    return AVERROR(ENOMEM);
+  }
+  audio_ring_set_rate(&ao->ring, ao->bytes_per_sec);
+
+  fprintf(stderr, "Audio output: %d Hz, %d channels, %d samples buffer\n",
+          ao->spec.freq, ao->spec.channels, ao->spec.samples);
+  return 0;
+}
+
+void audio_output_start(AudioOutput *ao) {
+  SDL_PauseAudioDevice(ao->device, SDL_FALSE);
+}
+
+int audio_output_write(AudioOutput *ao, const AVFrame *frame, double pts) {
+  // Upper bound of the output, with room for the sync compensation
+  int out_count = swr_get_out_samples(ao->swr, frame->nb_samples);
+  out_count += out_count * AUDIO_OUTPUT_MAX_COMPENSATION / 100 + 1;
+
+  av_fast_malloc(&ao->convert_buf, &ao->convert_buf_size,
+                 (size_t)out_count * ao->bytes_per_sample_frame);
+  if (!ao->convert_buf) {
+    return AVERROR(ENOMEM);
+  }
+
+  uint8_t *out = ao->convert_buf;
+  int got = swr_convert(ao->swr, &out, out_count,
+                        (const uint8_t **)frame->extended_data,
+                        frame->nb_samples);
+  if (got < 0) {
+    fprintf(stderr, "Error while resampling audio\n");
+    return got;
+  }
+  // Only this thread writes, so the written counter is exact here
+  if (!isnan(pts)) {
+    uint64_t written = ao->ring.written.load(std::memory_order_relaxed);
+    ao->pts_origin.store(pts - (double)written / ao->bytes_per_sec,
+                         std::memory_order_release);
+  }
+  return audio_ring_write_all(&ao->ring, ao->convert_buf,
+                              got * ao->bytes_per_sample_frame);
+}
+
+void audio_output_compensate(AudioOutput *ao, int nb_samples, double diff) {
+  int wanted = nb_samples + (int)(diff * ao->in_rate);
+  int min = nb_samples * (100 - AUDIO_OUTPUT_MAX_COMPENSATION) / 100;
+  int max = nb_samples * (100 + AUDIO_OUTPUT_MAX_COMPENSATION) / 100;
+
+  wanted = FFMIN(FFMAX(wanted, min), max);
+  swr_set_compensation(
+      ao->swr,
+      (int)((int64_t)(wanted - nb_samples) * ao->spec.freq / ao->in_rate),
+      (int)((int64_t)wanted * ao->spec.freq / ao->in_rate));
+}
+
+void audio_output_finish(AudioOutput *ao) {
+  audio_ring_finish(&ao->ring);
+}
+
+void audio_output_abort(AudioOutput *ao) {
+  audio_ring_abort(&ao->ring);
+}
+
+void audio_output_close(AudioOutput *ao) {
+  // Closing the device stops the callback before its state goes away
+  if (ao->device) {
+    SDL_CloseAudioDevice(ao->device);
+    ao->device = 0;
+  }
+  swr_free(&ao->swr);
+  av_freep(&ao->convert_buf);
+  audio_ring_destroy(&ao->ring);
+}
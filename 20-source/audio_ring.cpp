@@ -0,0 +1,207 @@
+#include "audio_ring.h"
+
+#include <SDL2/SDL.h>
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+#include <string.h>
+
+// Producer sleep while the ring is full. The callback drains a device
+// buffer at a time, so there is nothing to gain from spinning.
+#define AUDIO_RING_BACKOFF_MS 1
+// Longest sleep when the drain rate is known, bounds how late an abort is
+// noticed
+#define AUDIO_RING_MAX_BACKOFF_MS 250
+
+int audio_ring_init(AudioRing *r, unsigned capacity, unsigned frame_bytes) {
+  unsigned size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  r->buf = (uint8_t *)av_malloc(size);
+  if (!r->buf) {
+    return AVERROR(ENOMEM);
+  }
+  r->capacity = size;
+  r->mask = size - 1;
+  r->frame_bytes = frame_bytes ? frame_bytes : 1;
+
+  r->head.store(0);
+  r->tail.store(0);
+  r->finished.store(0);
+  r->abort_request.store(0);
+  r->rate.store(0);
+  r->written.store(0);
+  r->overruns.store(0);
+  r->read.store(0);
+  r->reads.store(0);
+  r->underruns.store(0);
+  r->underrun_bytes.store(0);
+  r->min_fill.store(size);
+  return 0;
+}
+
+void audio_ring_destroy(AudioRing *r) {
+  av_freep(&r->buf);
+  r->capacity = 0;
+  r->mask = 0;
+}
+
+unsigned audio_ring_fill(AudioRing *r) {
+  // Tail first: the head can only move further ahead of it meanwhile
+  unsigned tail = r->tail.load(std::memory_order_acquire);
+  return r->head.load(std::memory_order_acquire) - tail;
+}
+
+unsigned audio_ring_space(AudioRing *r) {
+  return r->capacity - audio_ring_fill(r);
+}
+
+static unsigned ring_write(AudioRing *r, const uint8_t *data, unsigned len) {
+  unsigned head = r->head.load(std::memory_order_relaxed);
+  unsigned tail = r->tail.load(std::memory_order_acquire);
+  unsigned space = r->capacity - (head - tail);
+  unsigned n = len < space ? len : space;
+
+  if (!n) {
+    return 0;
+  }
+  unsigned index = head & r->mask;
+  unsigned first = n < r->capacity - index ? n : r->capacity - index;
+  memcpy(r->buf + index, data, first);
+  memcpy(r->buf, data + first, n - first);
+  r->head.store(head + n, std::memory_order_release);
+  r->written.fetch_add(n, std::memory_order_relaxed);
+  return n;
+}
+
+unsigned audio_ring_write(AudioRing *r, const uint8_t *data, unsigned len) {
+  unsigned n = ring_write(r, data, len);
+  if (n < len) {
+    r->overruns.fetch_add(1, std::memory_order_relaxed);
+  }
+  return n;
+}
+
+// Time for the consumer to make room for |len| bytes, at least a quarter
+// of the ring so it is topped up in a few large writes, and at most half
+// so what is left never runs dry meanwhile
+static Uint32 backoff_ms(AudioRing *r, unsigned len) {
+  unsigned rate = r->rate.load(std::memory_order_relaxed);
+  unsigned want = len > r->capacity / 4 ? len : r->capacity / 4;
+  if (want > r->capacity / 2) {
+    want = r->capacity / 2;
+  }
+  unsigned space = audio_ring_space(r);
+  if (!rate || want <= space) {
+    return AUDIO_RING_BACKOFF_MS;
+  }
+
+  uint64_t ms = (uint64_t)(want - space) * 1000 / rate;
+  return ms < AUDIO_RING_BACKOFF_MS
+             ? AUDIO_RING_BACKOFF_MS
+             : ms > AUDIO_RING_MAX_BACKOFF_MS ? AUDIO_RING_MAX_BACKOFF_MS
+                                              : (Uint32)ms;
+}
+
+int audio_ring_write_all(AudioRing *r, const uint8_t *data, unsigned len) {
+  int waited = 0;
+
+  for (;;) {
+    if (r->abort_request.load(std::memory_order_acquire)) {
+      return AVERROR_EXIT;
+    }
+    unsigned n = ring_write(r, data, len);
+    data += n;
+    len -= n;
+    if (!len) {
+      return 0;
+    }
+    if (!waited) {
+      waited = 1;
+      r->overruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    SDL_Delay(backoff_ms(r, len));
+  }
+}
+
+void audio_ring_set_rate(AudioRing *r, unsigned bytes_per_sec) {
+  r->rate.store(bytes_per_sec, std::memory_order_relaxed);
+}
+
+unsigned audio_ring_peek(AudioRing *r, unsigned len, const uint8_t **data1,
+                         unsigned *size1, const uint8_t **data2,
+                         unsigned *size2) {
+  unsigned tail = r->tail.load(std::memory_order_relaxed);
+  unsigned head = r->head.load(std::memory_order_acquire);
+  unsigned fill = head - tail;
+  unsigned n = len < fill ? len : fill;
+
+  if (fill < r->min_fill.load(std::memory_order_relaxed)) {
+    r->min_fill.store(fill, std::memory_order_relaxed);
+  }
+  // Whole sample frames only, a split one would swap the channels
+  n -= n % r->frame_bytes;
+
+  unsigned index = tail & r->mask;
+  unsigned first = n < r->capacity - index ? n : r->capacity - index;
+  *data1 = r->buf + index;
+  *size1 = first;
+  *data2 = r->buf;
+  *size2 = n - first;
+  return n;
+}
+
+void audio_ring_consume(AudioRing *r, unsigned n, unsigned wanted) {
+  if (n) {
+    unsigned tail = r->tail.load(std::memory_order_relaxed);
+    r->tail.store(tail + n, std::memory_order_release);
+  }
+  r->reads.fetch_add(1, std::memory_order_relaxed);
+  r->read.fetch_add(n, std::memory_order_relaxed);
+  // The producer may have queued its last bytes just before finishing
+  if (n < wanted && !r->finished.load(std::memory_order_acquire)) {
+    r->underruns.fetch_add(1, std::memory_order_relaxed);
+    r->underrun_bytes.fetch_add(wanted - n, std::memory_order_relaxed);
+  }
+}
+
+unsigned audio_ring_read(AudioRing *r, uint8_t *dst, unsigned len,
+                         uint8_t silence) {
+  const uint8_t *data1, *data2;
+  unsigned size1, size2;
+  unsigned n = audio_ring_peek(r, len, &data1, &size1, &data2, &size2);
+
+  memcpy(dst, data1, size1);
+  memcpy(dst + size1, data2, size2);
+  if (n < len) {
+    memset(dst + n, silence, len - n);
+  }
+  audio_ring_consume(r, n, len);
+  return n;
+}
+
+void audio_ring_finish(AudioRing *r) {
+  r->finished.store(1, std::memory_order_release);
+}
+
+void audio_ring_abort(AudioRing *r) {
+  r->abort_request.store(1, std::memory_order_release);
+}
+
+AudioRingStats audio_ring_stats(AudioRing *r) {
+  AudioRingStats stats;
+
+  stats.capacity = r->capacity;
+  stats.fill = audio_ring_fill(r);
+  stats.min_fill = r->min_fill.load(std::memory_order_relaxed);
+  stats.written = r->written.load(std::memory_order_relaxed);
+  stats.read = r->read.load(std::memory_order_relaxed);
+  stats.reads = r->reads.load(std::memory_order_relaxed);
+  stats.overruns = r->overruns.load(std::memory_order_relaxed);
+  stats.underruns = r->underruns.load(std::memory_order_relaxed);
+  stats.underrun_bytes = r->underrun_bytes.load(std::memory_order_relaxed);
+  return stats;
+}
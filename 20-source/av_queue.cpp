@@ -0,0 +1,266 @@
+#include "av_queue.h"
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+#include <stdio.h>
+#include <string.h>
+
+// Returns SDL_MUTEX_TIMEDOUT once |timeout_ms| elapsed, < 0 waits forever.
+static int queue_wait(SDL_cond *cond, SDL_mutex *mutex, int timeout_ms) {
+  if (timeout_ms < 0) {
+    return SDL_CondWait(cond, mutex);
+  }
+  return SDL_CondWaitTimeout(cond, mutex, timeout_ms);
+}
+
+static int queue_sync_init(SDL_mutex **mutex, SDL_cond **cond) {
+  *mutex = SDL_CreateMutex();
+  if (!*mutex) {
+    fprintf(stderr, "SDL_CreateMutex failed: %s\n", SDL_GetError());
+    return AVERROR(ENOMEM);
+  }
+  *cond = SDL_CreateCond();
+  if (!*cond) {
+    fprintf(stderr, "SDL_CreateCond failed: %s\n", SDL_GetError());
+    SDL_DestroyMutex(*mutex);
+    *mutex = NULL;
+    return AVERROR(ENOMEM);
+  }
+  return 0;
+}
+
+int packet_queue_init(PacketQueue *q, int capacity) {
+  memset(q, 0, sizeof(*q));
+  q->pkts = (AVPacket **)av_mallocz(capacity * sizeof(*q->pkts));
+  if (!q->pkts) {
+    return AVERROR(ENOMEM);
+  }
+  q->stats.capacity = capacity;
+  for (int i = 0; i < capacity; i++) {
+    q->pkts[i] = av_packet_alloc();
+    if (!q->pkts[i]) {
+      packet_queue_destroy(q);
+      return AVERROR(ENOMEM);
+    }
+  }
+  int ret = queue_sync_init(&q->mutex, &q->cond);
+  if (ret < 0) {
+    packet_queue_destroy(q);
+  }
+  return ret;
+}
+
+void packet_queue_destroy(PacketQueue *q) {
+  if (q->pkts) {
+    for (int i = 0; i < q->stats.capacity; i++) {
+      av_packet_free(&q->pkts[i]);
+    }
+    av_freep(&q->pkts);
+  }
+  if (q->cond) {
+    SDL_DestroyCond(q->cond);
+  }
+  if (q->mutex) {
+    SDL_DestroyMutex(q->mutex);
+  }
+  memset(q, 0, sizeof(*q));
+}
+
+int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
+  SDL_LockMutex(q->mutex);
+  if (q->stats.depth == q->stats.capacity) {
+    q->stats.full_waits++;
+  }
+  while (q->stats.depth == q->stats.capacity && !q->abort_request) {
+    SDL_CondWait(q->cond, q->mutex);
+  }
+  if (q->abort_request) {
+    SDL_UnlockMutex(q->mutex);
+    av_packet_unref(pkt);
+    return AVERROR_EXIT;
+  }
+
+  int write_index = (q->read_index + q->stats.depth) % q->stats.capacity;
+  av_packet_move_ref(q->pkts[write_index], pkt);
+  q->stats.depth++;
+  q->stats.pushed++;
+  if (q->stats.depth > q->stats.max_depth) {
+    q->stats.max_depth = q->stats.depth;
+  }
+  SDL_CondSignal(q->cond);
+  SDL_UnlockMutex(q->mutex);
+  return 0;
+}
+
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, int timeout_ms) {
+  int ret = 0;
+
+  SDL_LockMutex(q->mutex);
+  if (q->stats.depth == 0 && !q->finished) {
+    q->stats.empty_waits++;
+  }
+  while (q->stats.depth == 0 && !q->finished && !q->abort_request) {
+    if (queue_wait(q->cond, q->mutex, timeout_ms) == SDL_MUTEX_TIMEDOUT) {
+      ret = AVERROR(EAGAIN);
+      break;
+    }
+  }
+  if (q->abort_request) {
+    ret = AVERROR_EXIT;
+  } else if (q->stats.depth > 0) {
+    av_packet_move_ref(pkt, q->pkts[q->read_index]);
+    q->read_index = (q->read_index + 1) % q->stats.capacity;
+    q->stats.depth--;
+    SDL_CondSignal(q->cond);
+    ret = 0;
+  } else if (q->finished) {
+    ret = AVERROR_EOF;
+  }
+  SDL_UnlockMutex(q->mutex);
+  return ret;
+}
+
+void packet_queue_finish(PacketQueue *q) {
+  SDL_LockMutex(q->mutex);
+  q->finished = 1;
+  SDL_CondBroadcast(q->cond);
+  SDL_UnlockMutex(q->mutex);
+}
+
+void packet_queue_abort(PacketQueue *q) {
+  SDL_LockMutex(q->mutex);
+  q->abort_request = 1;
+  SDL_CondBroadcast(q->cond);
+  SDL_UnlockMutex(q->mutex);
+}
+
+QueueStats packet_queue_stats(PacketQueue *q) {
+  SDL_LockMutex(q->mutex);
+  QueueStats stats = q->stats;
+  SDL_UnlockMutex(q->mutex);
+  return stats;
+}
+
+int frame_queue_init(FrameQueue *q, int capacity) {
+  memset(q, 0, sizeof(*q));
+  q->frames = (AVFrame **)av_mallocz(capacity * sizeof(*q->frames));
+  if (!q->frames) {
+    return AVERROR(ENOMEM);
+  }
+  q->stats.capacity = capacity;
+  for (int i = 0; i < capacity; i++) {
+    q->frames[i] = av_frame_alloc();
+    if (!q->frames[i]) {
+      frame_queue_destroy(q);
+      return AVERROR(ENOMEM);
+    }
+  }
+  int ret = queue_sync_init(&q->mutex, &q->cond);
+  if (ret < 0) {
+    frame_queue_destroy(q);
+  }
+  return ret;
+}
+
+void frame_queue_destroy(FrameQueue *q) {
+  if (q->frames) {
+    for (int i = 0; i < q->stats.capacity; i++) {
+      av_frame_free(&q->frames[i]);
+    }
+    av_freep(&q->frames);
+  }
+  if (q->cond) {
+    SDL_DestroyCond(q->cond);
+  }
+  if (q->mutex) {
+    SDL_DestroyMutex(q->mutex);
+  }
+  memset(q, 0, sizeof(*q));
+}
+
+int frame_queue_put(FrameQueue *q, AVFrame *frame) {
+  SDL_LockMutex(q->mutex);
+  if (q->stats.depth == q->stats.capacity) {
+    q->stats.full_waits++;
+  }
+  while (q->stats.depth == q->stats.capacity && !q->abort_request) {
+    SDL_CondWait(q->cond, q->mutex);
+  }
+  if (q->abort_request) {
+    SDL_UnlockMutex(q->mutex);
+    av_frame_unref(frame);
+    return AVERROR_EXIT;
+  }
+
+  int write_index = (q->read_index + q->stats.depth) % q->stats.capacity;
+  av_frame_move_ref(q->frames[write_index], frame);
+  q->stats.depth++;
+  q->stats.pushed++;
+  if (q->stats.depth > q->stats.max_depth) {
+    q->stats.max_depth = q->stats.depth;
+  }
+  SDL_CondSignal(q->cond);
+  SDL_UnlockMutex(q->mutex);
+  return 0;
+}
+
+int frame_queue_get(FrameQueue *q, AVFrame *frame, int timeout_ms) {
+  int ret = 0;
+
+  SDL_LockMutex(q->mutex);
+  if (q->stats.depth == 0 && !q->finished) {
+    q->stats.empty_waits++;
+  }
+  while (q->stats.depth == 0 && !q->finished && !q->abort_request) {
+    if (queue_wait(q->cond, q->mutex, timeout_ms) == SDL_MUTEX_TIMEDOUT) {
+      ret = AVERROR(EAGAIN);
+      break;
+    }
+  }
+  if (q->abort_request) {
+    ret = AVERROR_EXIT;
+  } else if (q->stats.depth > 0) {
+    av_frame_move_ref(frame, q->frames[q->read_index]);
+    q->read_index = (q->read_index + 1) % q->stats.capacity;
+    q->stats.depth--;
+    SDL_CondSignal(q->cond);
+    ret = 0;
+  } else if (q->finished) {
+    ret = AVERROR_EOF;
+  }
+  SDL_UnlockMutex(q->mutex);
+  return ret;
+}
+
+void frame_queue_finish(FrameQueue *q) {
+  SDL_LockMutex(q->mutex);
+  q->finished = 1;
+  SDL_CondBroadcast(q->cond);
+  SDL_UnlockMutex(q->mutex);
+}
+
+void frame_queue_abort(FrameQueue *q) {
+  SDL_LockMutex(q->mutex);
+  q->abort_request = 1;
+  SDL_CondBroadcast(q->cond);
+  SDL_UnlockMutex(q->mutex);
+}
+
+QueueStats frame_queue_stats(FrameQueue *q) {
+  SDL_LockMutex(q->mutex);
+  QueueStats stats = q->stats;
+  SDL_UnlockMutex(q->mutex);
+  return stats;
+}
+
+void queue_stats_print(const char *name, const QueueStats *stats) {
+  fprintf(stderr,
+          "%s queue: depth %d/%d (max %d), %llu pushed, "
+          "%llu full waits, %llu empty waits\n",
+          name, stats->depth, stats->capacity, stats->max_depth,
+          (unsigned long long)stats->pushed,
+          (unsigned long long)stats->full_waits,
+          (unsigned long long)stats->empty_waits);
+}
@@ -24,8 +24,11 @@
  * @file libavcodec audio decoding API usage example
  * @example decode_audio.c
  *
- * Decode data from an MP2 input file and generate a raw audio file to
- * be played with ffplay.
+ * Decode any audio stream libavformat can probe (AAC, Opus, FLAC, MP3,
+ * MP2, ...) or a raw elementary stream (--codec) and generate a raw,
+ * interleaved audio file to be played with ffplay. The output sample
+ * format, rate and channel layout can be requested; libswresample does
+ * the conversion through one persistent context.
  */
 
 #include <stdio.h>
@@ -34,15 +37,55 @@
 
 extern "C"
 {
+#include <libavutil/channel_layout.h>
 #include <libavutil/frame.h>
 #include <libavutil/mem.h>
+#include <libavutil/samplefmt.h>
 
 #include <libavcodec/avcodec.h>
-
+#include <libavformat/avformat.h>
+#include <libswresample/swresample.h>
 }
 
-#define AUDIO_INBUF_SIZE 20480
-#define AUDIO_REFILL_THRESH 4096
+#include "es_reader.h"
+#include "pcm_interleave.h"
+
+/* output buffer reused across frames, grown with av_fast_malloc */
+typedef struct {
+    uint8_t *data;
+    unsigned int size;
+} PcmBuffer;
+
+/* Where decoded frames go. The output format is fixed by the first frame
+ * (requested values win, the decoder's fill in the rest), so the raw file
+ * stays consistent even if the stream changes parameters midway. */
+typedef struct {
+    FILE *file;
+    PcmBuffer buf;
+
+    /* requested output; AV_SAMPLE_FMT_NONE / 0 / no channels keep the
+     * decoder's value */
+    enum AVSampleFormat req_fmt;
+    int req_rate;
+    AVChannelLayout req_layout;
+
+    /* resolved output, always packed */
+    int configured;
+    enum AVSampleFormat out_fmt;
+    int out_rate;
+    AVChannelLayout out_layout;
+
+    /* conversion state, only rebuilt when the decoder's output changes */
+    SwrContext *swr;
+    enum AVSampleFormat in_fmt;
+    int in_rate;
+    AVChannelLayout in_layout;
+
+    int64_t frames;
+    int64_t samples;
+    int64_t swr_frames;
+    int swr_inits;
+} AudioSink;
 
 static int get_format_from_sample_fmt(const char **fmt,
                                       enum AVSampleFormat sample_fmt)
@@ -73,11 +116,130 @@ static int get_format_from_sample_fmt(const char **fmt,
     return -1;
 }
 
+static uint8_t *sink_get_buffer(AudioSink *s, int nb_samples)
+{
+    size_t bytes = (size_t)nb_samples * s->out_layout.nb_channels *
+                   av_get_bytes_per_sample(s->out_fmt);
+
+    av_fast_malloc(&s->buf.data, &s->buf.size, bytes);
+    if (!s->buf.data) {
+        fprintf(stderr, "Could not allocate output buffer\n");
+        exit(1);
+    }
+    return s->buf.data;
+}
+
+static void sink_write(AudioSink *s, const uint8_t *data, int nb_samples)
+{
+    size_t bytes = (size_t)nb_samples * s->out_layout.nb_channels *
+                   av_get_bytes_per_sample(s->out_fmt);
+
+    fwrite(data, 1, bytes, s->file);
+    s->samples += nb_samples;
+}
+
+/* drain the samples swresample still holds and drop the context */
+static void sink_drain(AudioSink *s)
+{
+    if (!s->swr)
+        return;
+
+    for (;;) {
+        int out_count = swr_get_out_samples(s->swr, 0);
+        if (out_count <= 0)
+            break;
+        uint8_t *out = sink_get_buffer(s, out_count);
+        int got = swr_convert(s->swr, &out, out_count, NULL, 0);
+        if (got <= 0)
+            break;
+        sink_write(s, out, got);
+    }
+    swr_free(&s->swr);
+    av_channel_layout_uninit(&s->in_layout);
+}
+
+static void sink_configure(AudioSink *s, const AVFrame *frame)
+{
+    enum AVSampleFormat fmt = s->req_fmt != AV_SAMPLE_FMT_NONE ?
+                              s->req_fmt : (enum AVSampleFormat)frame->format;
+    int ret;
+
+    s->out_fmt  = av_get_packed_sample_fmt(fmt);
+    s->out_rate = s->req_rate ? s->req_rate : frame->sample_rate;
+    ret = av_channel_layout_copy(&s->out_layout, s->req_layout.nb_channels ?
+                                 &s->req_layout : &frame->ch_layout);
+    if (ret < 0) {
+        fprintf(stderr, "Could not set the output channel layout\n");
+        exit(1);
+    }
+    s->configured = 1;
+}
+
+static void sink_write_frame(AudioSink *s, const AVFrame *frame)
+{
+    enum AVSampleFormat in_fmt = (enum AVSampleFormat)frame->format;
+    int ret;
+
+    if (!s->configured)
+        sink_configure(s, frame);
+    s->frames++;
+
+    /* same rate and layout, only the packing may differ: no swresample */
+    if (frame->sample_rate == s->out_rate &&
+        !av_channel_layout_compare(&frame->ch_layout, &s->out_layout) &&
+        av_get_packed_sample_fmt(in_fmt) == s->out_fmt) {
+        sink_drain(s);
+
+        /* packed formats are already interleaved */
+        if (!av_sample_fmt_is_planar(in_fmt)) {
+            sink_write(s, frame->data[0], frame->nb_samples);
+            return;
+        }
+
+        uint8_t *out = sink_get_buffer(s, frame->nb_samples);
+        pcm_interleave(out, (const uint8_t *const *)frame->extended_data,
+                       s->out_layout.nb_channels, frame->nb_samples,
+                       av_get_bytes_per_sample(s->out_fmt));
+        sink_write(s, out, frame->nb_samples);
+        return;
+    }
+
+    /* (re)build the resampler only when the decoder's output changes */
+    if (!s->swr || in_fmt != s->in_fmt || frame->sample_rate != s->in_rate ||
+        av_channel_layout_compare(&frame->ch_layout, &s->in_layout)) {
+        sink_drain(s);
+
+        ret = swr_alloc_set_opts2(&s->swr, &s->out_layout, s->out_fmt, s->out_rate,
+                                  &frame->ch_layout, in_fmt, frame->sample_rate,
+                                  0, NULL);
+        if (ret < 0 || (ret = swr_init(s->swr)) < 0) {
+            fprintf(stderr, "Could not initialize the resampler\n");
+            exit(1);
+        }
+        s->in_fmt  = in_fmt;
+        s->in_rate = frame->sample_rate;
+        av_channel_layout_copy(&s->in_layout, &frame->ch_layout);
+        s->swr_inits++;
+    }
+
+    /* convert the whole frame at once into the reused buffer */
+    int out_count = swr_get_out_samples(s->swr, frame->nb_samples);
+    uint8_t *out = sink_get_buffer(s, out_count);
+    int got = swr_convert(s->swr, &out, out_count,
+                          (const uint8_t **)frame->extended_data,
+                          frame->nb_samples);
+    if (got < 0) {
+        fprintf(stderr, "Error while converting\n");
+        exit(1);
+    }
+    sink_write(s, out, got);
+    s->swr_frames++;
+}
+
 static void decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
-                   FILE *outfile)
+                   AudioSink *sink)
 {
-    int i, ch;
-    int ret, data_size;
+    int ret;
 
     /* send the packet with the compressed data to the decoder */
     ret = avcodec_send_packet(dec_ctx, pkt);
@@ -95,48 +257,86 @@ static void decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
             fprintf(stderr, "Error during decoding\n");
             exit(1);
         }
-        data_size = av_get_bytes_per_sample(dec_ctx->sample_fmt);
-        if (data_size < 0) {
+        if (av_get_bytes_per_sample((enum AVSampleFormat)frame->format) <= 0) {
             /* This should not occur, checking just for paranoia */
             fprintf(stderr, "Failed to calculate data size\n");
             exit(1);
         }
-        for (i = 0; i < frame->nb_samples; i++)
-            for (ch = 0; ch < dec_ctx->ch_layout.nb_channels; ch++)
-                fwrite(frame->data[ch] + data_size*i, 1, data_size, outfile);
+        sink_write_frame(sink, frame);
     }
 }
 
-int main(int argc, char **argv)
+/* container input: let libavformat probe it and decode the best audio stream */
+static void decode_container(const char *filename, AVPacket *pkt,
+                             AVFrame *frame, AudioSink *sink)
 {
-    const char *outfilename, *filename;
-    const AVCodec *codec;
-    AVCodecContext *c= NULL;
-    AVCodecParserContext *parser = NULL;
-    int len, ret;
-    FILE *f, *outfile;
-    uint8_t inbuf[AUDIO_INBUF_SIZE + AV_INPUT_BUFFER_PADDING_SIZE];
-    uint8_t *data;
-    size_t   data_size;
-    AVPacket *pkt;
-    AVFrame *decoded_frame = NULL;
-    enum AVSampleFormat sfmt;
-    int n_channels = 0;
-    const char *fmt;
+    AVFormatContext *fmt_ctx = NULL;
+    const AVCodec *codec = NULL;
+    AVCodecContext *c;
+    int ret, stream_index;
 
-    if (argc <= 2) {
-        fprintf(stderr, "Usage: %s <input file> <output file>\n", argv[0]);
-        exit(0);
+    if (avformat_open_input(&fmt_ctx, filename, NULL, NULL) < 0) {
+        fprintf(stderr, "Could not open %s\n", filename);
+        exit(1);
+    }
+    if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
+        fprintf(stderr, "Could not find stream information\n");
+        exit(1);
+    }
+    stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0);
+    if (stream_index < 0) {
+        fprintf(stderr, "Could not find a decodable audio stream\n");
+        exit(1);
     }
-    filename    = argv[1];
-    outfilename = argv[2];
 
-    pkt = av_packet_alloc();
+    c = avcodec_alloc_context3(codec);
+    if (!c) {
+        fprintf(stderr, "Could not allocate audio codec context\n");
+        exit(1);
+    }
+    if (avcodec_parameters_to_context(c, fmt_ctx->streams[stream_index]->codecpar) < 0 ||
+        avcodec_open2(c, codec, NULL) < 0) {
+        fprintf(stderr, "Could not open codec\n");
+        exit(1);
+    }
+    printf("input: %s, codec: %s\n", fmt_ctx->iformat->name, codec->name);
+
+    while ((ret = av_read_frame(fmt_ctx, pkt)) >= 0) {
+        if (pkt->stream_index == stream_index)
+            decode(c, pkt, frame, sink);
+        av_packet_unref(pkt);
+    }
+
+    /* flush the decoder */
+    pkt->data = NULL;
+    pkt->size = 0;
+    decode(c, pkt, frame, sink);
+
+    avcodec_free_context(&c);
+    avformat_close_input(&fmt_ctx);
+}
 
-    /* find the MPEG audio decoder */
-    codec = avcodec_find_decoder(AV_CODEC_ID_MP2);
+/* elementary stream input: the codec is named, the parser splits frames */
+static void decode_elementary_stream(const char *filename, const char *codec_name,
+                                     EsReaderMode read_mode, AVPacket *pkt,
+                                     AVFrame *frame, AudioSink *sink)
+{
+    const AVCodec *codec;
+    AVCodecContext *c = NULL;
+    AVCodecParserContext *parser = NULL;
+    EsReader reader;
+    const uint8_t *data;
+    size_t data_size;
+    int ret;
+
+    codec = avcodec_find_decoder_by_name(codec_name);
     if (!codec) {
-        fprintf(stderr, "Codec not found\n");
+        const AVCodecDescriptor *desc = avcodec_descriptor_get_by_name(codec_name);
+        if (desc)
+            codec = avcodec_find_decoder(desc->id);
+    }
+    if (!codec) {
+        fprintf(stderr, "Codec '%s' not found\n", codec_name);
         exit(1);
     }
 
@@ -158,83 +358,155 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    f = fopen(filename, "rb");
-    if (!f) {
-        fprintf(stderr, "Could not open %s\n", filename);
+    if (es_reader_open(&reader, filename, 0, read_mode) < 0)
         exit(1);
-    }
-    outfile = fopen(outfilename, "wb");
-    if (!outfile) {
-        av_free(c);
-        exit(1);
-    }
 
-    /* decode until eof */
-    data      = inbuf;
-    data_size = fread(inbuf, 1, AUDIO_INBUF_SIZE, f);
-
-    while (data_size > 0) {
-        if (!decoded_frame) {
-            if (!(decoded_frame = av_frame_alloc())) {
-                fprintf(stderr, "Could not allocate audio frame\n");
+    /* decode until eof; every window is consumed whole, the parser keeps
+     * partial frames across windows */
+    while (es_reader_next(&reader, &data, &data_size) > 0) {
+        while (data_size > 0) {
+            ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size,
+                                   data, data_size,
+                                   AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+            if (ret < 0) {
+                fprintf(stderr, "Error while parsing\n");
                 exit(1);
             }
-        }
+            data      += ret;
+            data_size -= ret;
 
-        ret = av_parser_parse2(parser, c, &pkt->data, &pkt->size,
-                               data, data_size,
-                               AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
-        if (ret < 0) {
-            fprintf(stderr, "Error while parsing\n");
-            exit(1);
-        }
-        data      += ret;
-        data_size -= ret;
-
-        if (pkt->size)
-            decode(c, pkt, decoded_frame, outfile);
-
-        if (data_size < AUDIO_REFILL_THRESH) {
-            memmove(inbuf, data, data_size);
-            data = inbuf;
-            len = fread(data + data_size, 1,
-                        AUDIO_INBUF_SIZE - data_size, f);
-            if (len > 0)
-                data_size += len;
+            if (pkt->size)
+                decode(c, pkt, frame, sink);
         }
     }
 
+    /* flush the parser */
+    av_parser_parse2(parser, c, &pkt->data, &pkt->size, NULL, 0,
+                     AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+    if (pkt->size)
+        decode(c, pkt, frame, sink);
+
     /* flush the decoder */
     pkt->data = NULL;
     pkt->size = 0;
-    decode(c, pkt, decoded_frame, outfile);
+    decode(c, pkt, frame, sink);
 
-    /* print output pcm infomations, because there have no metadata of pcm */
-    sfmt = c->sample_fmt;
+    es_reader_print_stats(&reader);
+    es_reader_close(&reader);
+    avcodec_free_context(&c);
+    av_parser_close(parser);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] <input file> <output file> [read|mmap]\n"
+            "  --codec name       input is a raw elementary stream of this codec\n"
+            "                     (read|mmap selects how it is read)\n"
+            "  --sample-fmt name  output sample format, e.g. s16, s32, flt\n"
+            "  --rate hz          output sample rate\n"
+            "  --layout name      output channel layout, e.g. mono, stereo, 5.1\n"
+            "Without --codec the input is probed by libavformat.\n",
+            prog);
+}
 
-    if (av_sample_fmt_is_planar(sfmt)) {
-        const char *packed = av_get_sample_fmt_name(sfmt);
-        printf("Warning: the sample format the decoder produced is planar "
-               "(%s). This example will output the first channel only.\n",
-               packed ? packed : "?");
-        sfmt = av_get_packed_sample_fmt(sfmt);
+int main(int argc, char **argv)
+{
+    const char *outfilename = NULL, *filename = NULL;
+    const char *codec_name = NULL;
+    EsReaderMode read_mode = ES_READER_MMAP;
+    AVPacket *pkt;
+    AVFrame *decoded_frame = NULL;
+    AudioSink sink;
+    char layout_name[64];
+    const char *fmt;
+    int i, ret;
+
+    memset(&sink, 0, sizeof(sink));
+    sink.req_fmt = AV_SAMPLE_FMT_NONE;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--codec") && i + 1 < argc) {
+            codec_name = argv[++i];
+        } else if (!strcmp(argv[i], "--sample-fmt") && i + 1 < argc) {
+            sink.req_fmt = av_get_sample_fmt(argv[++i]);
+            if (sink.req_fmt == AV_SAMPLE_FMT_NONE) {
+                fprintf(stderr, "Unknown sample format '%s'\n", argv[i]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+            sink.req_rate = atoi(argv[++i]);
+            if (sink.req_rate <= 0) {
+                fprintf(stderr, "Invalid sample rate '%s'\n", argv[i]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--layout") && i + 1 < argc) {
+            if (av_channel_layout_from_string(&sink.req_layout, argv[++i]) < 0) {
+                fprintf(stderr, "Unknown channel layout '%s'\n", argv[i]);
+                exit(1);
+            }
+        } else if (!filename) {
+            filename = argv[i];
+        } else if (!outfilename) {
+            outfilename = argv[i];
+        } else if (es_reader_parse_mode(argv[i], &read_mode) < 0) {
+            exit(1);
+        }
+    }
+    if (!filename || !outfilename) {
+        usage(argv[0]);
+        exit(0);
     }
 
-    n_channels = c->ch_layout.nb_channels;
-    if ((ret = get_format_from_sample_fmt(&fmt, sfmt)) < 0)
+    sink.file = fopen(outfilename, "wb");
+    if (!sink.file) {
+        fprintf(stderr, "Could not open %s\n", outfilename);
+        exit(1);
+    }
+
+    pkt = av_packet_alloc();
+    if (!pkt || !(decoded_frame = av_frame_alloc())) {
+        fprintf(stderr, "Could not allocate audio frame\n");
+        exit(1);
+    }
+
+    if (codec_name)
+        decode_elementary_stream(filename, codec_name, read_mode, pkt,
+                                 decoded_frame, &sink);
+    else
+        decode_container(filename, pkt, decoded_frame, &sink);
+
+    /* samples still buffered inside the resampler */
+    sink_drain(&sink);
+
+    if (!sink.configured) {
+        fprintf(stderr, "No audio was decoded\n");
         goto end;
+    }
+
+    printf("%lld frames, %lld samples written; %s\n",
+           (long long)sink.frames, (long long)sink.samples,
+           sink.swr_frames ? "converted with swresample" : "no conversion");
+    if (sink.swr_inits > 1)
+        printf("resampler rebuilt %d times for stream parameter changes\n",
+               sink.swr_inits - 1);
+
+    /* print output pcm infomations, because there have no metadata of pcm */
+    if ((ret = get_format_from_sample_fmt(&fmt, sink.out_fmt)) < 0)
+        goto end;
+    av_channel_layout_describe(&sink.out_layout, layout_name, sizeof(layout_name));
 
     printf("Play the output audio file with the command:\n"
-           "ffplay -f %s -ac %d -ar %d %s\n",
-           fmt, n_channels, c->sample_rate,
+           "ffplay -f %s -ch_layout %s -ar %d %s\n",
+           fmt, layout_name, sink.out_rate,
            outfilename);
 end:
-    fclose(outfile);
-    fclose(f);
+    fclose(sink.file);
 
-    avcodec_free_context(&c);
-    av_parser_close(parser);
+    av_channel_layout_uninit(&sink.req_layout);
+    av_channel_layout_uninit(&sink.out_layout);
     av_frame_free(&decoded_frame);
+    av_freep(&sink.buf.data);
     av_packet_free(&pkt);
 
     return 0;
@@ -0,0 +1,255 @@
+#include "decode_bench.h"
+
+#include <SDL2/SDL.h>
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/time.h>
+}
+#include <stdio.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "frame_converter.h"
+
+enum {
+  STAGE_DEMUX,
+  STAGE_DECODE,
+  STAGE_CONVERT,
+  STAGE_UPLOAD,
+  STAGE_COUNT,
+};
+
+static const char *kStageNames[STAGE_COUNT] = {"demux", "decode", "convert",
+                                               "upload"};
+
+typedef struct {
+  SDL_Window *window;
+  SDL_Renderer *renderer;
+  SDL_Texture *texture;
+  int tex_w;
+  int tex_h;
+} BenchUpload;
+
+static int upload_open(BenchUpload *up) {
+  // No display needed, the dummy driver still exercises the texture path
+  SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+  if (SDL_InitSubSystem(SDL_INIT_VIDEO) < 0) {
+    fprintf(stderr, "SDL video initialization failed: %s\n", SDL_GetError());
+    return -1;
+  }
+  up->window = SDL_CreateWindow("MP4 Bench", 0, 0, 64, 64, SDL_WINDOW_HIDDEN);
+  if (!up->window) {
+    fprintf(stderr, "Window creation failed: %s\n", SDL_GetError());
+    return -1;
+  }
+  up->renderer = SDL_CreateRenderer(up->window, -1, SDL_RENDERER_SOFTWARE);
+  if (!up->renderer) {
+    fprintf(stderr, "Renderer creation failed: %s\n", SDL_GetError());
+    return -1;
+  }
+  return 0;
+}
+
+static int upload_frame(BenchUpload *up, const uint8_t *const data[4],
+                        const int linesize[4], int width, int height) {
+  if (!up->texture || up->tex_w != width || up->tex_h != height) {
+    if (up->texture) {
+      SDL_DestroyTexture(up->texture);
+      up->texture = NULL;
+    }
+    up->texture = SDL_CreateTexture(up->renderer, SDL_PIXELFORMAT_IYUV,
+                                    SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (!up->texture) {
+      fprintf(stderr, "Texture creation failed: %s\n", SDL_GetError());
+      return -1;
+    }
+    up->tex_w = width;
+    up->tex_h = height;
+  }
+  if (SDL_UpdateYUVTexture(up->texture, NULL, data[0], linesize[0], data[1],
+                           linesize[1], data[2], linesize[2]) < 0) {
+    fprintf(stderr, "SDL_UpdateYUVTexture failed: %s\n", SDL_GetError());
+    return -1;
+  }
+  return 0;
+}
+
+static void upload_close(BenchUpload *up) {
+  if (up->texture) {
+    SDL_DestroyTexture(up->texture);
+  }
+  if (up->renderer) {
+    SDL_DestroyRenderer(up->renderer);
+  }
+  if (up->window) {
+    SDL_DestroyWindow(up->window);
+  }
+}
+
+static void print_latency(const char *name, std::vector<double> &us) {
+  if (us.empty()) {
+    return;
+  }
+  std::sort(us.begin(), us.end());
+  size_t n = us.size();
+  fprintf(stderr,
+          "  %-8s p50 %9.1f us  p90 %9.1f us  p99 %9.1f us  max %9.1f us\n",
+          name, us[n / 2], us[n * 90 / 100], us[n * 99 / 100], us[n - 1]);
+}
+
+static long peak_rss_kb(void) {
+#ifndef _WIN32
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    return usage.ru_maxrss;  // kilobytes on Linux
+  }
+#endif
+  return -1;
+}
+
+int decode_bench_run(const DecodeBenchOptions *opts, AVFormatContext *fmt_ctx,
+                     AVCodecContext *dec_ctx, int stream_index) {
+  std::vector<double> latency[STAGE_COUNT];
+  FrameConverter conv;
+  BenchUpload up = {0};
+  AVPacket *pkt = av_packet_alloc();
+  AVFrame *frame = av_frame_alloc();
+  uint64_t frames = 0, bytes_in = 0, bytes_out = 0;
+  uint64_t dropped = 0;   // packets the decoder rejected as invalid
+  int64_t decode_us = 0;  // decoder time since the last output frame
+  int pending = 0;        // pkt holds a packet the decoder has not accepted yet
+  int eof = 0;
+  int ret = 0;
+
+  frame_converter_init(&conv);
+  if (!pkt || !frame) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  if (opts->upload && upload_open(&up) < 0) {
+    ret = AVERROR_EXTERNAL;
+    goto end;
+  }
+
+  {
+    int64_t start = av_gettime_relative();
+
+    // Same send / drain / resend sequence as the player's run_decoder()
+    while (ret >= 0) {
+      if (!pending && !eof) {
+        int64_t t0 = av_gettime_relative();
+        ret = av_read_frame(fmt_ctx, pkt);
+        latency[STAGE_DEMUX].push_back(av_gettime_relative() - t0);
+        if (ret < 0) {
+          eof = 1;
+          ret = 0;
+        } else if (pkt->stream_index != stream_index) {
+          av_packet_unref(pkt);
+          continue;
+        } else {
+          bytes_in += pkt->size;
+          pending = 1;
+        }
+      }
+
+      int64_t t0 = av_gettime_relative();
+      ret = avcodec_send_packet(dec_ctx, pending ? pkt : NULL);
+      decode_us += av_gettime_relative() - t0;
+      if (ret == AVERROR(EAGAIN)) {
+        // Output has to be drained first, the packet stays pending
+      } else {
+        if (ret < 0 && ret != AVERROR_EOF) {
+          // A corrupt packet should not end the run, drop it and count it
+          fprintf(stderr, "Error sending packet to decoder\n");
+          dropped++;
+        }
+        if (pending) {
+          av_packet_unref(pkt);
+          pending = 0;
+        }
+      }
+
+      for (;;) {
+        t0 = av_gettime_relative();
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        decode_us += av_gettime_relative() - t0;
+        if (ret < 0) {
+          break;
+        }
+        latency[STAGE_DECODE].push_back(decode_us);
+        decode_us = 0;
+
+        // Same conversion decision as the player's renderFrame()
+        const uint8_t *const *data = frame->data;
+        const int *linesize = frame->linesize;
+        ConverterBuffer *yuv = NULL;
+        t0 = av_gettime_relative();
+        if (!frame_converter_passthrough(&conv, frame, frame->width,
+                                         frame->height, AV_PIX_FMT_YUV420P)) {
+          if (frame_converter_convert(&conv, frame, frame->width,
+                                      frame->height, AV_PIX_FMT_YUV420P,
+                                      &yuv) < 0) {
+            av_frame_unref(frame);
+            continue;
+          }
+          data = yuv->data;
+          linesize = yuv->linesize;
+        }
+        latency[STAGE_CONVERT].push_back(av_gettime_relative() - t0);
+
+        if (opts->upload) {
+          t0 = av_gettime_relative();
+          if (upload_frame(&up, data, linesize, frame->width,
+                           frame->height) < 0) {
+            // Later timings would not include the upload any more
+            av_frame_unref(frame);
+            ret = AVERROR_EXTERNAL;
+            goto end;
+          }
+          latency[STAGE_UPLOAD].push_back(av_gettime_relative() - t0);
+        }
+
+        frames++;
+        bytes_out += (uint64_t)frame->width * frame->height * 3 / 2;
+        av_frame_unref(frame);
+      }
+      if (ret == AVERROR_EOF) {
+        ret = 0;
+        break;  // decoder fully flushed
+      } else if (ret == AVERROR(EAGAIN)) {
+        ret = 0;
+      } else {
+        fprintf(stderr, "Error during decoding\n");
+      }
+    }
+    if (dropped) {
+      fprintf(stderr, "Benchmark: %llu packets rejected by the decoder\n",
+              (unsigned long long)dropped);
+    }
+
+    double elapsed = (av_gettime_relative() - start) / 1e6;
+    fprintf(stderr,
+            "Benchmark: %llu frames in %.2f s, %.1f fps, input %.2f MB/s, "
+            "output %.1f MB/s\n",
+            (unsigned long long)frames, elapsed,
+            elapsed > 0 ? frames / elapsed : 0.0,
+            elapsed > 0 ? bytes_in / elapsed / (1024 * 1024) : 0.0,
+            elapsed > 0 ? bytes_out / elapsed / (1024 * 1024) : 0.0);
+    for (int i = 0; i < STAGE_COUNT; i++) {
+      print_latency(kStageNames[i], latency[i]);
+    }
+    fprintf(stderr, "Peak RSS: %.1f MB\n", peak_rss_kb() / 1024.0);
+    frame_converter_print_stats(&conv);
+  }
+
+end:
+  upload_close(&up);
+  frame_converter_free(&conv);
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+  return ret;
+}
@@ -1,20 +1,50 @@
+#include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
 
 extern "C"
 {
+#include <libavutil/cpu.h>
 #include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
 #include <libavutil/mem.h>
+#include <libavutil/time.h>
 
 #include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
 
 }
 
-#define VIDEO_INBUF_SIZE 20480
-#define VIDEO_REFILL_THRESH 4096
+#include "es_reader.h"
+#include "yuv_writer.h"
+
+// GOPģʽ: ÿworkerƽֵķֶ, ֶԽฺԽ, ÿζҪseekʹ򿪽
+#define GOP_SEGMENTS_PER_WORKER 4
+// ƴӷֶļʱĿС
+#define GOP_STITCH_BLOCK (4 << 20)
+// ļ޷GOPз(ȱʱ, seekλֶ), Ϊ˳
+#define GOP_ERROR_SEQUENTIAL FFERRTAG('G', 'S', 'E', 'Q')
+
+// ģʽĬϵĽڴ
+#define BATCH_DEFAULT_MEM_MB 2048
+// 㵥ļʱͬʱڵ֡: H.264ο֡(16) + ֡ + 
+#define BATCH_FRAMES_PER_DECODER 18
 
-static char err_buf[128] = {0};
+// ģʽÿworker߳ʹԼĴϢ
+static thread_local char err_buf[128] = {0};
 static char* av_get_err(int errnum)
 {
     av_strerror(errnum, err_buf, 128);
@@ -28,8 +58,64 @@ static void print_video_format(const AVFrame *frame)
     printf("format: %u\n", frame->format);// ʽҪע
 }
 
-static void decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
-                   FILE *outfile)
+// ģʽworkerͬʱռõĽڴ
+typedef struct
+{
+    std::mutex lock;
+    std::condition_variable cond;
+    size_t limit;
+    size_t in_use;
+} MemoryBudget;
+
+// Ԥ bytes, ʱȴļ; ûκļڽʱǷ, ⵥļ
+static void budget_acquire(MemoryBudget *budget, size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(budget->lock);
+    budget->cond.wait(lock, [&] {
+        return budget->in_use == 0 || budget->in_use + bytes <= budget->limit;
+    });
+    budget->in_use += bytes;
+}
+
+static void budget_release(MemoryBudget *budget, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(budget->lock);
+    budget->in_use -= bytes;
+    budget->cond.notify_all();
+}
+
+typedef struct
+{
+    int threads;            // ÿ߳, 0ΪԶ
+    MemoryBudget *budget;   // ģʽʹ
+    YuvWriterFormat format; // ʽ: raw / nv12 / y4m
+    int index;              // Ƿͬʱд <ļ>.idx ֡
+} DecodeOptions;
+
+// Ϣ(֡, ߱, ʱ)ʽ֡, st Ϊ NULL ʱʹĬֵ
+static int configure_output(YuvWriter *writer, const char *outfilename,
+                            const DecodeOptions *opts, const AVStream *st,
+                            int stream_header)
+{
+    YuvWriterOptions out;
+    std::string index_path = std::string(outfilename) + ".idx";
+
+    yuv_writer_options_default(&out);
+    out.format = opts->format;
+    out.stream_header = stream_header;
+    if (opts->index)
+        out.index_path = index_path.c_str();
+    if (st)
+    {
+        out.frame_rate = st->avg_frame_rate;
+        out.sample_aspect_ratio = st->codecpar->sample_aspect_ratio;
+        out.time_base = st->time_base;
+    }
+    return yuv_writer_configure(writer, &out);
+}
+
+static int decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
+                  YuvWriter *writer)
 {
     int ret;
     /* send the packet with the compressed data to the decoder */
@@ -42,7 +128,7 @@ static void decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
     {
         fprintf(stderr, "Error submitting the packet to the decoder, err:%s, pkt_size:%d\n",
                 av_get_err(ret), pkt->size);
-        return;
+        return 0;   // 𻵵İ
     }
 
     /* read all the output frames (infile general there may be any number of them */
@@ -51,151 +137,1013 @@ static void decode(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame,
         // frame, avcodec_receive_frameڲÿζȵ
         ret = avcodec_receive_frame(dec_ctx, frame);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-            return;
+            return 0;
         else if (ret < 0)
         {
             fprintf(stderr, "Error during decoding\n");
-            exit(1);
+            return ret;
         }
-        static int s_print_format = 0;
-        if(s_print_format == 0)
-        {
-            s_print_format = 1;
+        static std::atomic<int> s_print_format(0);
+        if(s_print_format.exchange(1) == 0)
             print_video_format(frame);
-        }
 
         // һH264ĬΪ AV_PIX_FMT_YUV420P, ôǿתΪ AV_PIX_FMT_YUV420P Ƶϳʱ򽲽
-        //  дy
-        fwrite(frame->data[0], 1, frame->width * frame->height,  outfile);//Y
-        // дu
-        fwrite(frame->data[1], 1, (frame->width) *(frame->height)/4,outfile);//U:߾Yһ
-        //  дv
-        fwrite(frame->data[2], 1, (frame->width) *(frame->height)/4,outfile);//V߾Yһ
+        // linesizeд(Y, U, V), ȥÿĩβĶ
+        if ((ret = yuv_writer_write_frame(writer, frame)) < 0)
+            return ret;
     }
+    return 0;
 }
+// (MP4/MKV/TS)ֱ뼴, libavformat̽ʽ
+// Ҫ --codec ָ,  --codec h264 / --codec mpeg2video
 // ȡH264: ffmpeg -i source.200kbps.768x320_10s.flv -vcodec libx264 -an -f h264 source.200kbps.768x320_10s.h264
 // ȡMPEG2: ffmpeg -i source.200kbps.768x320_10s.flv -vcodec mpeg2video -an -f mpeg2video source.200kbps.768x320_10s.mpeg2
 // ţffplay -pixel_format yuv420p -video_size 768x320 -framerate 25  source.200kbps.768x320_10s.yuv
-int main(int argc, char **argv)
+// 򿪽Ĺ, par Ϊ NULL ʱɽлò
+// ʧʱAVERRORҲ˳, GOPģʽһļӰļ
+static int open_decoder(const AVCodec *codec, const AVCodecParameters *par, int threads,
+                        AVCodecContext **codec_ctx)
 {
-    const char *outfilename;
-    const char *filename;
-    const AVCodec *codec;
-    AVCodecContext *codec_ctx= NULL;
-    AVCodecParserContext *parser = NULL;
-    int len = 0;
-    int ret = 0;
-    FILE *infile = NULL;
-    FILE *outfile = NULL;
-    // AV_INPUT_BUFFER_PADDING_SIZE βҪ󸽼ӷֽڵϽн
-    uint8_t inbuf[VIDEO_INBUF_SIZE + AV_INPUT_BUFFER_PADDING_SIZE];
-    uint8_t *data = NULL;
-    size_t   data_size = 0;
-    AVPacket *pkt = NULL;
-    AVFrame *decoded_frame = NULL;
+    int ret;
+
+    *codec_ctx = avcodec_alloc_context3(codec);
+    if (!*codec_ctx) {
+        fprintf(stderr, "Could not allocate video codec context\n");
+        return AVERROR(ENOMEM);
+    }
+    if (par && (ret = avcodec_parameters_to_context(*codec_ctx, par)) < 0) {
+        fprintf(stderr, "Could not copy codec parameters to context\n");
+        avcodec_free_context(codec_ctx);
+        return ret;
+    }
+    (*codec_ctx)->thread_count = threads;
+    if ((ret = avcodec_open2(*codec_ctx, codec, NULL)) < 0) {
+        fprintf(stderr, "Could not open codec, err:%s\n", av_get_err(ret));
+        avcodec_free_context(codec_ctx);
+        return ret;
+    }
+    return 0;
+}
 
-    if (argc <= 2)
+// ҵѵƵ, 
+static int open_video_input(const char *filename, AVFormatContext **fmt_ctx,
+                            const AVCodec **codec, int verbose)
+{
+    int ret;
+
+    if ((ret = avformat_open_input(fmt_ctx, filename, NULL, NULL)) < 0) {
+        fprintf(stderr, "Could not open %s, err:%s\n", filename, av_get_err(ret));
+        return ret;
+    }
+    if ((ret = avformat_find_stream_info(*fmt_ctx, NULL)) < 0) {
+        fprintf(stderr, "Could not find stream information\n");
+        avformat_close_input(fmt_ctx);
+        return ret;
+    }
+    int stream_index = av_find_best_stream(*fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, codec, 0);
+    if (stream_index < 0) {
+        fprintf(stderr, "Could not find a decodable video stream\n");
+        avformat_close_input(fmt_ctx);
+        return stream_index;
+    }
+    if (verbose)
+        printf("input: %s, codec: %s\n", (*fmt_ctx)->iformat->name, (*codec)->name);
+    return stream_index;
+}
+
+// : libavformat⸴, ֻѵƵ
+static int decode_container(const char *filename, const char *outfilename,
+                            const DecodeOptions *opts, AVPacket *pkt, AVFrame *frame,
+                            YuvWriter *writer)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    const AVCodec *codec = NULL;
+    int ret;
+
+    int stream_index = open_video_input(filename, &fmt_ctx, &codec, 1);
+    if (stream_index < 0)
+        return stream_index;
+    if ((ret = configure_output(writer, outfilename, opts, fmt_ctx->streams[stream_index], 1)) < 0)
     {
-        fprintf(stderr, "Usage: %s <input file> <output file>\n", argv[0]);
-        exit(0);
+        avformat_close_input(&fmt_ctx);
+        return ret;
     }
-    filename    = argv[1];
-    outfilename = argv[2];
 
-    pkt = av_packet_alloc();
-    enum AVCodecID video_codec_id = AV_CODEC_ID_H264;
+    AVCodecContext *codec_ctx = NULL;
+    if ((ret = open_decoder(codec, fmt_ctx->streams[stream_index]->codecpar, opts->threads,
+                            &codec_ctx)) < 0)
+    {
+        // Ԥڽ֮Ԥ, ֻҪر
+        avformat_close_input(&fmt_ctx);
+        return ret;
+    }
+
+    // ֱʹļʱռõ֡, Ԥڲſʼ
+    size_t reserved = 0;
+    if (opts->budget)
+    {
+        int frame_bytes = av_image_get_buffer_size(
+            codec_ctx->pix_fmt != AV_PIX_FMT_NONE ? codec_ctx->pix_fmt : AV_PIX_FMT_YUV420P,
+            codec_ctx->width, codec_ctx->height, 32);
+        reserved = (size_t)FFMAX(frame_bytes, 0) *
+                   (BATCH_FRAMES_PER_DECODER + codec_ctx->thread_count) +
+                   YUV_WRITER_BLOCK_SIZE;
+        budget_acquire(opts->budget, reserved);
+    }
+
+    while ((ret = av_read_frame(fmt_ctx, pkt)) >= 0)
+    {
+        if (pkt->stream_index == stream_index)
+            ret = decode(codec_ctx, pkt, frame, writer);
+        av_packet_unref(pkt);
+        if (ret < 0)
+            break;
+    }
+
+    if (ret == AVERROR_EOF)
+    {
+        /* ˢ */
+        pkt->data = NULL;   // drain mode
+        pkt->size = 0;
+        ret = decode(codec_ctx, pkt, frame, writer);
+    }
 
-    // ҽ
-    codec = avcodec_find_decoder(video_codec_id);  // AV_CODEC_ID_AAC
+    if (opts->budget)
+        budget_release(opts->budget, reserved);
+    avcodec_free_context(&codec_ctx);
+    avformat_close_input(&fmt_ctx);
+    return ret;
+}
+
+// :  codec_name ҽͽ, ȡ(mmap)齻
+static int decode_elementary_stream(const char *filename, const char *outfilename,
+                                    const char *codec_name, size_t buf_size,
+                                    EsReaderMode read_mode, const DecodeOptions *opts,
+                                    AVPacket *pkt, AVFrame *frame, YuvWriter *writer)
+{
+    EsReader reader;
+    const uint8_t *data = NULL;
+    size_t data_size = 0;
+    int ret;
+
+    // ҽ, ȿǽ(h264, libdav1d)ҲǱʽ(mpeg2video, av1)
+    const AVCodec *codec = avcodec_find_decoder_by_name(codec_name);
     if (!codec) {
-        fprintf(stderr, "Codec not found\n");
-        exit(1);
+        const AVCodecDescriptor *desc = avcodec_descriptor_get_by_name(codec_name);
+        if (desc)
+            codec = avcodec_find_decoder(desc->id);
+    }
+    if (!codec) {
+        fprintf(stderr, "Codec '%s' not found\n", codec_name);
+        return AVERROR_DECODER_NOT_FOUND;
     }
     // ȡĽ AVCodecParserContext()  +  AVCodecParser()
-    parser = av_parser_init(codec->id);
+    AVCodecParserContext *parser = av_parser_init(codec->id);
     if (!parser) {
         fprintf(stderr, "Parser not found\n");
-        exit(1);
+        return AVERROR(ENOSYS);
     }
-    // codec
-    codec_ctx = avcodec_alloc_context3(codec);
-    if (!codec_ctx) {
-        fprintf(stderr, "Could not allocate audio codec context\n");
-        exit(1);
+    // û֡ʺʱ, ʹĬֵ
+    if ((ret = configure_output(writer, outfilename, opts, NULL, 1)) < 0 ||
+        (ret = es_reader_open(&reader, filename, buf_size, read_mode)) < 0) {
+        av_parser_close(parser);
+        return ret;
+    }
+    AVCodecContext *codec_ctx = NULL;
+    if ((ret = open_decoder(codec, NULL, opts->threads, &codec_ctx)) < 0) {
+        es_reader_close(&reader);
+        av_parser_close(parser);
+        return ret;
     }
 
-    // ͽĽй
-    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
-        fprintf(stderr, "Could not open codec\n");
-        exit(1);
+    // ڲỺ治֡, ÿݶܱȫ, Ҫmemmoveʣ
+    while ((ret = es_reader_next(&reader, &data, &data_size)) > 0)
+    {
+        while (data_size > 0 && ret >= 0)
+        {
+            ret = av_parser_parse2(parser, codec_ctx, &pkt->data, &pkt->size,
+                                   data, data_size,
+                                   AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+            if (ret < 0)
+            {
+                fprintf(stderr, "Error while parsing\n");
+                break;
+            }
+            data      += ret;   // Ѿ
+            data_size -= ret;   // ӦĻСҲӦС
+
+            if (pkt->size)
+                ret = decode(codec_ctx, pkt, frame, writer);
+        }
+        if (ret < 0)
+            break;
     }
 
-    // ļ
-    infile = fopen(filename, "rb");
-    if (!infile) {
-        fprintf(stderr, "Could not open %s\n", filename);
-        exit(1);
+    if (ret == 0)
+    {
+        // ȡлһ֡
+        av_parser_parse2(parser, codec_ctx, &pkt->data, &pkt->size, NULL, 0,
+                         AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        if (pkt->size)
+            ret = decode(codec_ctx, pkt, frame, writer);
     }
-    // ļ
-    outfile = fopen(outfilename, "wb");
-    if (!outfile) {
-        av_free(codec_ctx);
-        exit(1);
+    if (ret == 0)
+    {
+        /* ˢ */
+        pkt->data = NULL;   // drain mode
+        pkt->size = 0;
+        ret = decode(codec_ctx, pkt, frame, writer);
     }
 
-    // ȡļн
-    data      = inbuf;
-    data_size = fread(inbuf, 1, VIDEO_INBUF_SIZE, infile);
+    es_reader_print_stats(&reader);
+    es_reader_close(&reader);
+    avcodec_free_context(&codec_ctx);
+    av_parser_close(parser);
+    return ret;
+}
+
+// һGOPֶ: һIDRʼ, һֶεIDR֮ǰ
+typedef struct
+{
+    int64_t start_pts;
+    int64_t start_dts;
+    uint64_t packets;
+} GopSegment;
 
-    while (data_size > 0)
+// H.264/HEVCĹؼ֡ǷIDRI֡(open GOP), B֡οһGOP, Ϊֶε.
+// ǷIDR NALԪ; ʽֻŹؼ֡
+static int starts_closed_gop(const AVCodecParameters *par, const AVPacket *pkt)
+{
+    if (!(pkt->flags & AV_PKT_FLAG_KEY))
+        return 0;
+    if (par->codec_id != AV_CODEC_ID_H264 && par->codec_id != AV_CODEC_ID_HEVC)
+        return 1;
+
+    int hevc = par->codec_id == AV_CODEC_ID_HEVC;
+    // avcC/hvcC extradata ʾ"+NAL"ʽ, Annex Bʼʽ
+    int length_size = 0;
+    if (par->extradata_size > (hevc ? 22 : 4) && par->extradata[0] == 1)
+        length_size = (par->extradata[hevc ? 21 : 4] & 3) + 1;
+
+    const uint8_t *p = pkt->data;
+    const uint8_t *end = pkt->data + pkt->size;
+    while (p < end)
     {
-        if (!decoded_frame)
+        const uint8_t *nal;
+        if (length_size)
+        {
+            if (end - p < length_size)
+                break;
+            uint32_t len = 0;
+            for (int i = 0; i < length_size; i++)
+                len = (len << 8) | p[i];
+            nal = p + length_size;
+            p = nal + len;
+        }
+        else
         {
-            if (!(decoded_frame = av_frame_alloc()))
+            while (end - p >= 3 && !(p[0] == 0 && p[1] == 0 && p[2] == 1))
+                p++;
+            if (end - p < 3)
+                break;
+            nal = p += 3;
+        }
+        if (nal >= end)
+            break;
+        int type = hevc ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+        if (hevc ? (type == 19 || type == 20) : type == 5)
+            return 1;
+    }
+    return 0;
+}
+
+// һֻ⸴ò: ¼ÿԶGOP, ٺϲɴСķֶ
+static int index_gop_segments(const char *filename, int target_segments,
+                              std::vector<GopSegment> *segments)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    const AVCodec *codec = NULL;
+    AVPacket *pkt = av_packet_alloc();
+    std::vector<GopSegment> gops;
+    uint64_t total = 0;
+    int ret;
+
+    int stream_index = open_video_input(filename, &fmt_ctx, &codec, 1);
+    if (stream_index < 0)
+    {
+        av_packet_free(&pkt);
+        return stream_index;
+    }
+    const AVCodecParameters *par = fmt_ctx->streams[stream_index]->codecpar;
+
+    while ((ret = av_read_frame(fmt_ctx, pkt)) >= 0)
+    {
+        if (pkt->stream_index == stream_index)
+        {
+            // ֶεı߽簴dts, ûdts޷з
+            if (pkt->dts == AV_NOPTS_VALUE)
             {
-                fprintf(stderr, "Could not allocate audio frame\n");
-                exit(1);
+                fprintf(stderr, "Stream has packets without timestamps\n");
+                ret = GOP_ERROR_SEQUENTIAL;
+                av_packet_unref(pkt);
+                break;
+            }
+            if (starts_closed_gop(par, pkt))
+            {
+                GopSegment gop = {pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts, pkt->dts, 0};
+                gops.push_back(gop);
             }
+            // һIDR֮ǰİ޷, ˳ʱͬᶪ
+            if (!gops.empty())
+                gops.back().packets++;
+            total++;
         }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&fmt_ctx);
+    if (ret != AVERROR_EOF)
+        return ret;
+    if (gops.empty())
+    {
+        fprintf(stderr, "No IDR frames found\n");
+        return AVERROR_INVALIDDATA;
+    }
+
+    uint64_t target = total / target_segments + 1;
+    for (size_t i = 0; i < gops.size(); i++)
+    {
+        if (segments->empty() || segments->back().packets >= target)
+            segments->push_back(gops[i]);
+        else
+            segments->back().packets += gops[i].packets;
+    }
+    printf("index: %llu packets, %zu IDR frames, %zu segments\n",
+           (unsigned long long)total, gops.size(), segments->size());
+    return 0;
+}
 
-        ret = av_parser_parse2(parser, codec_ctx, &pkt->data, &pkt->size,
-                               data, data_size,
-                               AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+typedef struct
+{
+    const char *filename;
+    const char *outfilename;
+    YuvWriterMode write_mode;
+    DecodeOptions opts;
+    const std::vector<GopSegment> *segments;
+
+    std::atomic<size_t> next;
+    std::atomic<int> error;     // һʧֶܷεĴ, 0ʾȫɹ
+    std::atomic<uint64_t> frames;
+} GopState;
+
+static std::string segment_path(const char *outfilename, size_t index)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".part%05zu", index);
+    return std::string(outfilename) + suffix;
+}
+
+// һֶ: seekIDR֮ǰ, ֮ǰİ, һֶεͳˢ
+static int decode_segment(GopState *gs, AVFormatContext *fmt_ctx, int stream_index,
+                          const AVCodec *codec, size_t index, AVPacket *pkt, AVFrame *frame)
+{
+    const GopSegment *seg = &(*gs->segments)[index];
+    const GopSegment *next = index + 1 < gs->segments->size() ? seg + 1 : NULL;
+    YuvWriter writer;
+    int started = 0;
+    int ret;
+
+    if ((ret = av_seek_frame(fmt_ctx, stream_index, seg->start_pts, AVSEEK_FLAG_BACKWARD)) < 0)
+    {
+        fprintf(stderr, "Seek failed, err:%s\n", av_get_err(ret));
+        return ret;
+    }
+    std::string part = segment_path(gs->outfilename, index);
+    if ((ret = yuv_writer_open(&writer, part.c_str(), gs->write_mode)) < 0)
+        return ret;
+    // ֻеһֶдY4Mļͷ, ֶεƴʱϲ
+    if ((ret = configure_output(&writer, part.c_str(), &gs->opts,
+                                fmt_ctx->streams[stream_index], index == 0)) < 0)
+    {
+        yuv_writer_close(&writer);
+        return ret;
+    }
+    AVCodecContext *codec_ctx = NULL;
+    if ((ret = open_decoder(codec, fmt_ctx->streams[stream_index]->codecpar, gs->opts.threads,
+                            &codec_ctx)) < 0)
+    {
+        yuv_writer_close(&writer);
+        return ret;
+    }
+
+    while ((ret = av_read_frame(fmt_ctx, pkt)) >= 0)
+    {
+        if (pkt->stream_index != stream_index)
+        {
+            av_packet_unref(pkt);
+            continue;
+        }
+        if (next && pkt->dts >= next->start_dts)
+        {
+            av_packet_unref(pkt);
+            break;
+        }
+        if (!started)
+        {
+            if (pkt->dts > seg->start_dts)
+            {
+                fprintf(stderr, "Seek landed after the start of segment %zu\n", index);
+                ret = GOP_ERROR_SEQUENTIAL;
+            }
+            started = pkt->dts == seg->start_dts;
+        }
+        if (started && ret >= 0)
+            ret = decode(codec_ctx, pkt, frame, &writer);
+        av_packet_unref(pkt);
+        if (ret < 0)
+            break;
+    }
+
+    if (ret >= 0 || ret == AVERROR_EOF)
+    {
+        /* ˢ */
+        pkt->data = NULL;   // drain mode
+        pkt->size = 0;
+        ret = decode(codec_ctx, pkt, frame, &writer);
+    }
+    avcodec_free_context(&codec_ctx);
+    int close_ret = yuv_writer_close(&writer);
+    gs->frames += writer.frames;
+    return ret < 0 ? ret : close_ret;
+}
+
+// worker: ԼĽ⸴, ȡһֶ, ÿֶʹµĽ
+static void gop_worker(GopState *gs)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    const AVCodec *codec = NULL;
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+
+    int stream_index = open_video_input(gs->filename, &fmt_ctx, &codec, 0);
+    if (stream_index >= 0 && (!pkt || !frame))
+        stream_index = AVERROR(ENOMEM);
+    if (stream_index < 0)
+    {
+        int expected = 0;
+        gs->error.compare_exchange_strong(expected, stream_index);
+        gs->next = gs->segments->size();
+    }
+    for (size_t i = gs->next++; i < gs->segments->size(); i = gs->next++)
+    {
+        int ret = decode_segment(gs, fmt_ctx, stream_index, codec, i, pkt, frame);
         if (ret < 0)
         {
-            fprintf(stderr, "Error while parsing\n");
-            exit(1);
+            // ֶѾû, worker˳
+            int expected = 0;
+            if (ret == GOP_ERROR_SEQUENTIAL)
+                gs->error = ret;    // ˳´ļ, ֶεĴҪ
+            else if (gs->error.compare_exchange_strong(expected, ret))
+                fprintf(stderr, "Segment %zu failed, err:%s\n", i, av_get_err(ret));
+            gs->next = gs->segments->size();
         }
-        data      += ret;   // Ѿ
-        data_size -= ret;   // ӦĻСҲӦС
+    }
 
-        if (pkt->size)
-            decode(codec_ctx, pkt, decoded_frame, outfile);
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avformat_close_input(&fmt_ctx);
+}
 
-        if (data_size < VIDEO_REFILL_THRESH)    // ٴζȡ
+// ѷֶε׷ӵ: ֻһֶεͷ, ֡ƫƼǰֶεܴС
+static int append_segment_index(FILE *out, const std::string &part, int first, uint64_t base)
+{
+    std::string path = part + ".idx";
+    FILE *in = fopen(path.c_str(), "rb");
+    YuvIndexHeader hdr;
+    YuvIndexEntry entry;
+    int ret = 0;
+
+    if (!in)
+        return AVERROR(errno);
+    if (fread(&hdr, sizeof(hdr), 1, in) == 1 && first && fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+        ret = AVERROR(EIO);
+    while (ret == 0 && fread(&entry, sizeof(entry), 1, in) == 1)
+    {
+        entry.offset += base;
+        if (fwrite(&entry, sizeof(entry), 1, out) != 1)
+            ret = AVERROR(EIO);
+    }
+    fclose(in);
+    unlink(path.c_str());
+    return ret;
+}
+
+// ˳ѷֶļƴӵļ, ɾֶļ
+static int stitch_segments(const char *outfilename, size_t count, int index)
+{
+    int out = open(outfilename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    uint8_t *buf = (uint8_t *)av_malloc(GOP_STITCH_BLOCK);
+    int ret = 0;
+
+    std::string index_path = std::string(outfilename) + ".idx";
+    FILE *out_index = index ? fopen(index_path.c_str(), "wb") : NULL;
+    uint64_t base = 0;
+    struct stat st;
+
+    if (out < 0 || !buf || (index && !out_index))
+    {
+        fprintf(stderr, "Could not open %s\n", outfilename);
+        ret = AVERROR(EIO);
+    }
+    for (size_t i = 0; i < count && ret == 0; i++)
+    {
+        std::string part = segment_path(outfilename, i);
+        int in = open(part.c_str(), O_RDONLY);
+        if (in < 0 || fstat(in, &st) < 0)
+        {
+            ret = AVERROR(errno);
+            break;
+        }
+        if (out_index && (ret = append_segment_index(out_index, part, i == 0, base)) < 0)
+            fprintf(stderr, "Error merging the index of %s\n", part.c_str());
+        base += st.st_size;
+        ssize_t n;
+#ifdef __linux__
+        // ں�, ֧reflinkļϵͳֻԪ
+        while ((n = copy_file_range(in, NULL, out, NULL, GOP_STITCH_BLOCK, 0)) > 0)
         {
-            memmove(inbuf, data, data_size);    // ֮ǰʣݿbufferʼλ
-            data = inbuf;
-            // ȡ : VIDEO_INBUF_SIZE - data_size
-            len = fread(data + data_size, 1, VIDEO_INBUF_SIZE - data_size, infile);
-            if (len > 0)
-                data_size += len;
         }
+        if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL))
+#endif
+        {
+            while ((n = read(in, buf, GOP_STITCH_BLOCK)) > 0)
+            {
+                if (write(out, buf, n) != n)
+                {
+                    n = -1;
+                    break;
+                }
+            }
+        }
+        if (n < 0)
+        {
+            fprintf(stderr, "Error stitching %s\n", part.c_str());
+            ret = AVERROR(EIO);
+        }
+        close(in);
+        unlink(part.c_str());
+    }
+    if (out >= 0)
+        close(out);
+    if (out_index && fclose(out_index) != 0 && ret == 0)
+        ret = AVERROR(EIO);
+    av_free(buf);
+    return ret;
+}
+
+// ·: ͵ļģʽһļһ
+static int decode_sequential(const char *filename, const char *outfilename,
+                             YuvWriterMode write_mode, const DecodeOptions *opts)
+{
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    YuvWriter writer;
+    int ret = AVERROR(ENOMEM);
+
+    printf("gop parallel: cannot split %s, decoding it sequentially\n", filename);
+    if (pkt && frame && (ret = yuv_writer_open(&writer, outfilename, write_mode)) >= 0)
+    {
+        ret = decode_container(filename, outfilename, opts, pkt, frame, &writer);
+        int close_ret = yuv_writer_close(&writer);
+        if (ret >= 0)
+            ret = close_ret;
+        yuv_writer_print_stats(&writer);
     }
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    return ret;
+}
+
+static int run_gop_parallel(const char *filename, const char *outfilename, int jobs,
+                            YuvWriterMode write_mode, const DecodeOptions *opts)
+{
+    std::vector<GopSegment> segments;
+    int cpus = av_cpu_count();
+    if (jobs <= 0)
+        jobs = cpus;
 
-    /* ˢ */
-    pkt->data = NULL;   // drain mode
-    pkt->size = 0;
-    decode(codec_ctx, pkt, decoded_frame, outfile);
+    int64_t start = av_gettime_relative();
+    int ret = index_gop_segments(filename, jobs * GOP_SEGMENTS_PER_WORKER, &segments);
+    if (ret == GOP_ERROR_SEQUENTIAL)
+        return decode_sequential(filename, outfilename, write_mode, opts);
+    if (ret < 0)
+        return ret;
+    double index_seconds = (av_gettime_relative() - start) / 1e6;
+    if (jobs > (int)segments.size())
+        jobs = (int)segments.size();
 
-    fclose(outfile);
-    fclose(infile);
+    GopState gs;
+    gs.filename = filename;
+    gs.outfilename = outfilename;
+    gs.write_mode = write_mode;
+    gs.opts = *opts;
+    gs.opts.threads = FFMAX(cpus / jobs, 1);
+    gs.opts.budget = NULL;
+    gs.segments = &segments;
+    gs.next = 0;
+    gs.error = 0;
+    gs.frames = 0;
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < jobs; i++)
+        workers.emplace_back(gop_worker, &gs);
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    double decode_seconds = (av_gettime_relative() - start) / 1e6 - index_seconds;
+
+    ret = gs.error;
+    if (ret == 0 && (ret = stitch_segments(outfilename, segments.size(), opts->index)) < 0)
+    {
+        // ƴһûô; ʧʱûдļ, Ҫɾеͬļ
+        unlink(outfilename);
+        unlink((std::string(outfilename) + ".idx").c_str());
+    }
+    if (ret < 0)
+    {
+        // ʧܵķֶο˷ֶļ, ƴ;ʧʱķֶҲûɾ
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            unlink(segment_path(outfilename, i).c_str());
+            unlink((segment_path(outfilename, i) + ".idx").c_str());
+        }
+        if (ret == GOP_ERROR_SEQUENTIAL)
+            return decode_sequential(filename, outfilename, write_mode, opts);
+        fprintf(stderr, "gop parallel: failed, err:%s\n", av_get_err(ret));
+        return ret;
+    }
+    double seconds = (av_gettime_relative() - start) / 1e6;
+    uint64_t frames = gs.frames;
+    printf("gop parallel: %llu frames, %d workers x %d decoder threads, "
+           "index %.2f s, decode %.2f s, stitch %.2f s: %.1f fps\n",
+           (unsigned long long)frames, jobs, gs.opts.threads, index_seconds,
+           decode_seconds, seconds - index_seconds - decode_seconds,
+           seconds > 0 ? frames / seconds : 0.0);
+    return ret;
+}
+
+// ģʽ: Ŀ¼µļ(), ÿһ·бļ
+static int collect_inputs(const char *path, std::vector<std::string> *inputs)
+{
+    struct stat st;
+    if (stat(path, &st) < 0)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return -1;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(path);
+        if (!dir)
+        {
+            fprintf(stderr, "Could not open %s\n", path);
+            return -1;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            std::string file = std::string(path) + "/" + entry->d_name;
+            if (stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                inputs->push_back(file);
+        }
+        closedir(dir);
+        std::sort(inputs->begin(), inputs->end());
+        return 0;
+    }
+
+    FILE *list = fopen(path, "r");
+    if (!list)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return -1;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), list))
+    {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] && line[0] != '#')
+            inputs->push_back(line);
+    }
+    fclose(list);
+    return 0;
+}
+
+typedef struct
+{
+    const std::vector<std::string> *inputs;
+    const std::vector<std::string> *outputs;
+    YuvWriterMode write_mode;
+    DecodeOptions opts;
+
+    std::atomic<size_t> next;
+    std::atomic<int> error;     // worker(ڴ治), workerȡļ
+    std::mutex lock;     // ͳƺ
+    int failed;
+    uint64_t frames;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+} BatchState;
+
+// ÿļ: <Ŀ¼>/<ļ>.yuv, ͬĿ¼µͬļμ .1 .2 ... 
+static void make_output_names(const std::vector<std::string> &inputs, const char *outdir,
+                              YuvWriterFormat format, std::vector<std::string> *outputs)
+{
+    const char *ext = format == YUV_WRITER_FORMAT_Y4M ? ".y4m" : ".yuv";
+    std::set<std::string> used;
+
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        size_t slash = inputs[i].find_last_of('/');
+        std::string name = slash == std::string::npos ? inputs[i] : inputs[i].substr(slash + 1);
+        std::string base = std::string(outdir) + "/" + name;
+        std::string output = base + ext;
+        for (int n = 1; !used.insert(output).second; n++)
+            output = base + "." + std::to_string(n) + ext;
+        if (output != base + ext)
+            printf("batch: %s -> %s (name collision)\n", inputs[i].c_str(), output.c_str());
+        outputs->push_back(output);
+    }
+}
+
+// worker: ȡһļ, ÿļʹöĽļ
+static void batch_worker(BatchState *bs)
+{
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    size_t i;
+
+    if (!pkt || !frame)
+    {
+        // ˳: workerдļ, ʣµļ̱߳Ϊʧ
+        fprintf(stderr, "Could not allocate video frame\n");
+        bs->error = AVERROR(ENOMEM);
+    }
+    while (!bs->error && (i = bs->next++) < bs->inputs->size())
+    {
+        const std::string &input = (*bs->inputs)[i];
+        const std::string &output = (*bs->outputs)[i];
+        YuvWriter writer;
+        struct stat st;
+        int64_t start = av_gettime_relative();
+
+        int ret = yuv_writer_open(&writer, output.c_str(), bs->write_mode);
+        if (ret >= 0)
+        {
+            ret = decode_container(input.c_str(), output.c_str(), &bs->opts, pkt, frame,
+                                   &writer);
+            int close_ret = yuv_writer_close(&writer);
+            if (ret >= 0)
+                ret = close_ret;
+            // һûô
+            if (ret < 0)
+            {
+                unlink(output.c_str());
+                unlink((output + ".idx").c_str());
+            }
+        }
+        double seconds = (av_gettime_relative() - start) / 1e6;
+
+        std::lock_guard<std::mutex> lock(bs->lock);
+        if (ret < 0)
+        {
+            bs->failed++;
+            fprintf(stderr, "[%zu/%zu] %s: failed, err:%s\n", i + 1, bs->inputs->size(),
+                    input.c_str(), av_get_err(ret));
+            continue;
+        }
+        bs->frames += writer.frames;
+        bs->bytes_out += writer.bytes;
+        if (stat(input.c_str(), &st) == 0)
+            bs->bytes_in += st.st_size;
+        printf("[%zu/%zu] %s: %llu frames in %.2f s\n", i + 1, bs->inputs->size(),
+               input.c_str(), (unsigned long long)writer.frames, seconds);
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+}
+
+static int run_batch(const char *input_list, const char *outdir, int jobs,
+                     size_t mem_limit, YuvWriterMode write_mode, const DecodeOptions *opts)
+{
+    std::vector<std::string> inputs;
+    if (collect_inputs(input_list, &inputs) < 0)
+        return -1;
+    if (inputs.empty())
+    {
+        fprintf(stderr, "No input files in %s\n", input_list);
+        return -1;
+    }
+    mkdir(outdir, 0755);
+    std::vector<std::string> outputs;
+    make_output_names(inputs, outdir, opts->format, &outputs);
+
+    // Ĭÿһļ, ߳ƽʣµĺ, ߳
+    int cpus = av_cpu_count();
+    if (jobs <= 0)
+        jobs = cpus;
+    if (jobs > (int)inputs.size())
+        jobs = (int)inputs.size();
+
+    MemoryBudget budget;
+    budget.limit = mem_limit;
+    budget.in_use = 0;
+
+    BatchState bs;
+    bs.inputs = &inputs;
+    bs.outputs = &outputs;
+    bs.write_mode = write_mode;
+    bs.opts = *opts;
+    bs.opts.threads = FFMAX(cpus / jobs, 1);
+    bs.opts.budget = &budget;
+    bs.next = 0;
+    bs.error = 0;
+    bs.failed = 0;
+    bs.frames = 0;
+    bs.bytes_in = 0;
+    bs.bytes_out = 0;
+
+    printf("batch: %zu files, %d workers x %d decoder threads, memory limit %zu MB\n",
+           inputs.size(), jobs, bs.opts.threads, mem_limit >> 20);
+
+    int64_t start = av_gettime_relative();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < jobs; i++)
+        workers.emplace_back(batch_worker, &bs);
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    double seconds = (av_gettime_relative() - start) / 1e6;
+
+    // workerûбȡļʧ, ǻûдκ
+    for (size_t i = bs.next; bs.error && i < inputs.size(); i++)
+    {
+        bs.failed++;
+        fprintf(stderr, "[%zu/%zu] %s: not started, err:%s\n", i + 1, inputs.size(),
+                inputs[i].c_str(), av_get_err(bs.error));
+    }
+    printf("batch: %zu files (%d failed), %llu frames in %.2f s: %.1f fps, "
+           "input %.1f MB/s, output %.1f MB/s\n",
+           inputs.size(), bs.failed, (unsigned long long)bs.frames, seconds,
+           seconds > 0 ? bs.frames / seconds : 0.0,
+           seconds > 0 ? bs.bytes_in / seconds / (1024 * 1024) : 0.0,
+           seconds > 0 ? bs.bytes_out / seconds / (1024 * 1024) : 0.0);
+    return bs.failed ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--codec name [--buffer-mb N] [--input read|mmap]] "
+            "[--format raw|nv12|y4m] [--index] <input file> <output file> "
+            "[buffered|direct|writev]\n"
+            "       %s --batch <directory|list file> <output directory> "
+            "[-j N] [--mem-mb N] [buffered|direct|writev]\n"
+            "       %s --gop-parallel <input file> <output file> "
+            "[-j N] [buffered|direct|writev]\n", prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *outfilename = NULL;
+    const char *filename = NULL;
+    const char *codec_name = NULL;
+    size_t buf_size = ES_READER_DEFAULT_BUFFER;
+    EsReaderMode read_mode = ES_READER_MMAP;
+    int ret = 0;
+    YuvWriter writer;
+    YuvWriterMode write_mode = YUV_WRITER_BUFFERED;
+    AVPacket *pkt = NULL;
+    AVFrame *decoded_frame = NULL;
+    DecodeOptions opts = {0, NULL, YUV_WRITER_FORMAT_RAW, 0};
+    int batch = 0;
+    int gop_parallel = 0;
+    int es_option = 0;      // ֻԵЧѡ
+    int reader_option = 0;  // ֻӰȡѡ(--input, --buffer-mb)
+    int jobs = 0;
+    size_t mem_limit = (size_t)BATCH_DEFAULT_MEM_MB << 20;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--batch"))
+            batch = 1;
+        else if (!strcmp(argv[i], "--gop-parallel"))
+            gop_parallel = 1;
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            jobs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--mem-mb") && i + 1 < argc)
+        {
+            int mb = atoi(argv[++i]);
+            mem_limit = mb > 0 ? (size_t)mb << 20 : mem_limit;
+        }
+        // ʽ: raw(Ĭ, ƽʽ), nv12(UV֯), y4m(ļͷ, ֱʶ)
+        else if (!strcmp(argv[i], "--format") && i + 1 < argc)
+        {
+            if (yuv_writer_parse_format(argv[++i], &opts.format) < 0)
+            {
+                usage(argv[0]);
+                exit(1);
+            }
+        }
+        // ֡: ÿ֡ƫ, pts͹ؼ֡, ι߿ֱӶλ֡
+        else if (!strcmp(argv[i], "--index"))
+            opts.index = 1;
+        else if (!strcmp(argv[i], "--codec") && i + 1 < argc)
+        {
+            codec_name = argv[++i];
+            es_option = 1;
+        }
+        else if (!strcmp(argv[i], "--buffer-mb") && i + 1 < argc)
+        {
+            es_option = reader_option = 1;
+            int mb = atoi(argv[++i]);   // ȡС, 1~8MB
+            buf_size = mb > 0 ? (size_t)mb << 20 : ES_READER_DEFAULT_BUFFER;
+        }
+        else if (!strcmp(argv[i], "--input") && i + 1 < argc)
+        {
+            es_option = reader_option = 1;
+            if (es_reader_parse_mode(argv[++i], &read_mode) < 0)
+            {
+                usage(argv[0]);
+                exit(1);
+            }
+        }
+        else if (!filename)
+            filename = argv[i];
+        else if (!outfilename)
+            outfilename = argv[i];
+        // ʽ: buffered(Ĭ, ϲɴд), direct(O_DIRECT), writev(, ֱӾۺϸ)
+        else if (yuv_writer_parse_mode(argv[i], &write_mode) < 0)
+        {
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (!filename || !outfilename)
+    {
+        usage(argv[0]);
+        exit(0);
+    }
+    // GOPģʽֻ, ѡᱻ, ֱӱĺ
+    if ((batch || gop_parallel) && es_option)
+    {
+        fprintf(stderr, "--codec, --input and --buffer-mb cannot be used with %s\n",
+                batch ? "--batch" : "--gop-parallel");
+        usage(argv[0]);
+        exit(1);
+    }
+    // libavformatȡ, û --codec ʱȡѡͬᱻ
+    if (reader_option && !codec_name)
+    {
+        fprintf(stderr, "--input and --buffer-mb can only be used with --codec\n");
+        usage(argv[0]);
+        exit(1);
+    }
+    if (batch && gop_parallel)
+    {
+        fprintf(stderr, "--batch and --gop-parallel cannot be used together\n");
+        usage(argv[0]);
+        exit(1);
+    }
+    // ģʽ: ΪĿ¼бļ, ΪĿ¼, ÿ <ļ>.yuv (ʱ)
+    if (batch)
+        return run_batch(filename, outfilename, jobs, mem_limit, write_mode, &opts) < 0 ? 1 : 0;
+    // GOPģʽ: IDRзֵļ, ֶβн˳ƴ
+    if (gop_parallel)
+        return run_gop_parallel(filename, outfilename, jobs, write_mode, &opts) < 0 ? 1 : 0;
+
+    pkt = av_packet_alloc();
+    decoded_frame = av_frame_alloc();
+    if (!pkt || !decoded_frame)
+    {
+        fprintf(stderr, "Could not allocate video frame\n");
+        exit(1);
+    }
+
+    // ļ
+    if (yuv_writer_open(&writer, outfilename, write_mode) < 0)
+        exit(1);
+
+    if (codec_name)
+        ret = decode_elementary_stream(filename, outfilename, codec_name, buf_size,
+                                       read_mode, &opts, pkt, decoded_frame, &writer);
+    else
+        ret = decode_container(filename, outfilename, &opts, pkt, decoded_frame, &writer);
+
+    yuv_writer_close(&writer);
+    yuv_writer_print_stats(&writer);
 
-    avcodec_free_context(&codec_ctx);
-    av_parser_close(parser);
     av_frame_free(&decoded_frame);
     av_packet_free(&pkt);
 
     printf("main finish, please enter Enter and exit\n");
-    return 0;
+    return ret < 0 ? 1 : 0;
 }
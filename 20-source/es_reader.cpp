@@ -0,0 +1,175 @@
+#include "es_reader.h"
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+}
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *kModeNames[] = {"read", "mmap"};
+
+const char *es_reader_mode_name(EsReaderMode mode) { return kModeNames[mode]; }
+
+int es_reader_parse_mode(const char *name, EsReaderMode *mode) {
+  for (int i = 0; i < (int)(sizeof(kModeNames) / sizeof(kModeNames[0]));
+       i++) {
+    if (!strcmp(name, kModeNames[i])) {
+      *mode = (EsReaderMode)i;
+      return 0;
+    }
+  }
+  fprintf(stderr, "Unknown input mode '%s', expected read|mmap\n", name);
+  return AVERROR(EINVAL);
+}
+
+static int map_file(EsReader *r) {
+  struct stat st;
+
+  if (fstat(r->fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    return AVERROR(EINVAL);
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+  if (map == MAP_FAILED) {
+    return AVERROR(errno);
+  }
+  // Read-ahead aggressively and drop pages behind the parser early
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  r->map = (uint8_t *)map;
+  r->map_size = st.st_size;
+  return 0;
+}
+
+int es_reader_open(EsReader *r, const char *path, size_t buf_size,
+                   EsReaderMode mode) {
+  memset(r, 0, sizeof(*r));
+  r->mode = mode;
+  if (buf_size == 0) {
+    buf_size = ES_READER_DEFAULT_BUFFER;
+  } else if (buf_size < ES_READER_MIN_BUFFER) {
+    buf_size = ES_READER_MIN_BUFFER;
+  }
+  r->buf_size = buf_size;
+
+  r->fd = open(path, O_RDONLY);
+  if (r->fd < 0) {
+    fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+    return AVERROR(errno);
+  }
+  if (mode == ES_READER_MMAP && map_file(r) < 0) {
+    fprintf(stderr, "Could not map %s, reading it instead\n", path);
+    r->mode = ES_READER_READ;
+  }
+
+  size_t alloc = r->mode == ES_READER_MMAP ? ES_READER_MMAP_TAIL : buf_size;
+  r->buf = (uint8_t *)av_malloc(alloc + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (!r->buf) {
+    es_reader_close(r);
+    return AVERROR(ENOMEM);
+  }
+  return 0;
+}
+
+static int next_mapped(EsReader *r, const uint8_t **data, size_t *size) {
+  size_t tail_start =
+      r->map_size > ES_READER_MMAP_TAIL ? r->map_size - ES_READER_MMAP_TAIL : 0;
+
+  if (r->map_pos >= r->map_size) {
+    return 0;
+  }
+  if (r->map_pos < tail_start) {
+    // Zero-copy window; whatever follows it up to tail_start and the tail
+    // itself is mapped, which covers the padding the parser may touch
+    size_t n = tail_start - r->map_pos;
+    if (n > r->buf_size) {
+      n = r->buf_size;
+    }
+    *data = r->map + r->map_pos;
+    *size = n;
+    r->map_pos += n;
+    // Have the kernel start on the next window while this one is parsed
+    size_t ahead = r->map_size - r->map_pos;
+    if (ahead > 0) {
+      size_t page = (size_t)sysconf(_SC_PAGESIZE);
+      size_t start = r->map_pos & ~(page - 1);
+      madvise(r->map + start, ahead < r->buf_size ? ahead : r->buf_size,
+              MADV_WILLNEED);
+    }
+  } else {
+    size_t n = r->map_size - r->map_pos;
+    memcpy(r->buf, r->map + r->map_pos, n);
+    memset(r->buf + n, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    *data = r->buf;
+    *size = n;
+    r->map_pos += n;
+  }
+  r->reads++;
+  r->bytes += *size;
+  return 1;
+}
+
+int es_reader_next(EsReader *r, const uint8_t **data, size_t *size) {
+  int64_t start = av_gettime_relative();
+  size_t filled = 0;
+
+  if (r->mode == ES_READER_MMAP) {
+    int ret = next_mapped(r, data, size);
+    r->read_us += av_gettime_relative() - start;
+    return ret;
+  }
+
+  // Fill the whole window unless the file ends, short reads included
+  while (filled < r->buf_size) {
+    ssize_t n = read(r->fd, r->buf + filled, r->buf_size - filled);
+    r->reads++;
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Error reading input: %s\n", strerror(errno));
+      return AVERROR(errno);
+    }
+    if (n == 0) {
+      break;
+    }
+    filled += n;
+  }
+  r->read_us += av_gettime_relative() - start;
+  if (filled == 0) {
+    return 0;
+  }
+
+  memset(r->buf + filled, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  r->bytes += filled;
+  *data = r->buf;
+  *size = filled;
+  return 1;
+}
+
+void es_reader_close(EsReader *r) {
+  if (r->map) {
+    munmap(r->map, r->map_size);
+    r->map = NULL;
+  }
+  if (r->fd >= 0) {
+    close(r->fd);
+  }
+  r->fd = -1;
+  av_freep(&r->buf);
+}
+
+void es_reader_print_stats(const EsReader *r) {
+  double seconds = r->read_us / 1e6;
+  fprintf(stderr,
+          "Input (%s): %.1f MB in %llu %s, %.1f MB/s while reading\n",
+          es_reader_mode_name(r->mode), r->bytes / (1024.0 * 1024.0),
+          (unsigned long long)r->reads,
+          r->mode == ES_READER_MMAP ? "windows" : "read calls",
+          seconds > 0 ? r->bytes / seconds / (1024.0 * 1024.0) : 0.0);
+}
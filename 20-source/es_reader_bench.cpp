@@ -0,0 +1,169 @@
+// Micro-benchmark: elementary-stream input feeding av_parser_parse2.
+//
+// Compares the refill loop decode_video / decode_audio used to have (fread
+// into a 20 KB buffer, memmove the unparsed tail back on every refill)
+// against EsReader's large read() windows and its mmap windows. Only the
+// parser runs, so the numbers are input plus parsing cost without decoding.
+//
+// The whole file is read once up front so every mode sees the same warm page
+// cache; drop the cache between runs to measure cold reads instead.
+//
+// Usage: es_reader_bench <input file> <codec> [buffer MB]
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/time.h>
+}
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "es_reader.h"
+
+#define LEGACY_INBUF_SIZE 20480
+#define LEGACY_REFILL_THRESH 4096
+
+typedef struct {
+  uint64_t packets;
+  uint64_t bytes;
+  uint64_t copied;  // bytes moved by memmove / memcpy
+} ParseStats;
+
+static void parse_window(AVCodecParserContext *parser, AVCodecContext *ctx,
+                         const uint8_t *data, size_t size, ParseStats *st) {
+  uint8_t *out;
+  int out_size;
+
+  while (size > 0) {
+    int ret = av_parser_parse2(parser, ctx, &out, &out_size, data, (int)size,
+                               AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+    if (ret < 0) {
+      fprintf(stderr, "Error while parsing\n");
+      exit(1);
+    }
+    data += ret;
+    size -= ret;
+    if (out_size) {
+      st->packets++;
+    }
+  }
+}
+
+static void run_legacy(const char *path, AVCodecParserContext *parser,
+                       AVCodecContext *ctx, ParseStats *st) {
+  uint8_t inbuf[LEGACY_INBUF_SIZE + AV_INPUT_BUFFER_PADDING_SIZE] = {0};
+  uint8_t *out;
+  int out_size;
+  FILE *f = fopen(path, "rb");
+
+  if (!f) {
+    fprintf(stderr, "Could not open %s\n", path);
+    exit(1);
+  }
+  uint8_t *data = inbuf;
+  size_t data_size = fread(inbuf, 1, LEGACY_INBUF_SIZE, f);
+  st->bytes += data_size;
+  while (data_size > 0) {
+    int ret = av_parser_parse2(parser, ctx, &out, &out_size, data,
+                               (int)data_size, AV_NOPTS_VALUE, AV_NOPTS_VALUE,
+                               0);
+    if (ret < 0) {
+      fprintf(stderr, "Error while parsing\n");
+      exit(1);
+    }
+    data += ret;
+    data_size -= ret;
+    if (out_size) {
+      st->packets++;
+    }
+    if (data_size < LEGACY_REFILL_THRESH) {
+      memmove(inbuf, data, data_size);
+      st->copied += data_size;
+      data = inbuf;
+      size_t len = fread(data + data_size, 1, LEGACY_INBUF_SIZE - data_size, f);
+      data_size += len;
+      st->bytes += len;
+    }
+  }
+  fclose(f);
+}
+
+static void run_reader(const char *path, EsReaderMode mode, size_t buf_size,
+                       AVCodecParserContext *parser, AVCodecContext *ctx,
+                       ParseStats *st) {
+  EsReader reader;
+  const uint8_t *data;
+  size_t size;
+
+  if (es_reader_open(&reader, path, buf_size, mode) < 0) {
+    exit(1);
+  }
+  while (es_reader_next(&reader, &data, &size) > 0) {
+    parse_window(parser, ctx, data, size, st);
+    st->bytes += size;
+  }
+  es_reader_close(&reader);
+}
+
+static void run(const char *name, int which, const char *path,
+                const AVCodec *codec, size_t buf_size) {
+  AVCodecParserContext *parser = av_parser_init(codec->id);
+  AVCodecContext *ctx = avcodec_alloc_context3(codec);
+  ParseStats st = {0};
+
+  if (!parser || !ctx) {
+    fprintf(stderr, "Could not create %s parser\n", codec->name);
+    exit(1);
+  }
+
+  int64_t start = av_gettime_relative();
+  if (which < 0) {
+    run_legacy(path, parser, ctx, &st);
+  } else {
+    run_reader(path, (EsReaderMode)which, buf_size, parser, ctx, &st);
+  }
+  double seconds = (av_gettime_relative() - start) / 1e6;
+
+  printf("%-8s %8.1f MB  %9llu packets  %8.3f s  %8.1f MB/s  copied %8.1f MB\n",
+         name, st.bytes / (1024.0 * 1024.0), (unsigned long long)st.packets,
+         seconds, seconds > 0 ? st.bytes / seconds / (1024.0 * 1024.0) : 0.0,
+         st.copied / (1024.0 * 1024.0));
+
+  av_parser_close(parser);
+  avcodec_free_context(&ctx);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <input file> <codec> [buffer MB]\n", argv[0]);
+    return -1;
+  }
+  const char *path = argv[1];
+  size_t buf_size = argc > 3 && atoi(argv[3]) > 0 ? (size_t)atoi(argv[3]) << 20
+                                                  : ES_READER_DEFAULT_BUFFER;
+
+  const AVCodec *codec = avcodec_find_decoder_by_name(argv[2]);
+  if (!codec) {
+    const AVCodecDescriptor *desc = avcodec_descriptor_get_by_name(argv[2]);
+    codec = desc ? avcodec_find_decoder(desc->id) : NULL;
+  }
+  if (!codec) {
+    fprintf(stderr, "Codec '%s' not found\n", argv[2]);
+    return -1;
+  }
+
+  // Warm the page cache so the first mode is not penalised
+  EsReader reader;
+  const uint8_t *data;
+  size_t size;
+  if (es_reader_open(&reader, path, buf_size, ES_READER_READ) < 0) {
+    return -1;
+  }
+  while (es_reader_next(&reader, &data, &size) > 0) {
+  }
+  es_reader_close(&reader);
+
+  run("fread", -1, path, codec, buf_size);
+  run("read", ES_READER_READ, path, codec, buf_size);
+  run("mmap", ES_READER_MMAP, path, codec, buf_size);
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include "event_wait.h"
+
+extern "C" {
+#include <libavutil/error.h>
+}
+#include <stdio.h>
+
+static int SDLCALL wake_on_event(void *opaque, SDL_Event *event) {
+  (void)event;
+  SDL_SemPost((SDL_sem *)opaque);
+  return 1;
+}
+
+int event_wait_init(EventWait *w) {
+  w->sem = NULL;
+  w->start_ms = SDL_GetTicks();
+  w->wakeups = 0;
+  w->timeouts = 0;
+  if (SDL_WasInit(SDL_INIT_VIDEO)) {
+    return 0;
+  }
+
+  w->sem = SDL_CreateSemaphore(0);
+  if (!w->sem) {
+    return AVERROR(ENOMEM);
+  }
+  SDL_AddEventWatch(wake_on_event, w->sem);
+  return 0;
+}
+
+void event_wait_close(EventWait *w) {
+  if (w->sem) {
+    SDL_DelEventWatch(wake_on_event, w->sem);
+    SDL_DestroySemaphore(w->sem);
+    w->sem = NULL;
+  }
+}
+
+int event_wait(EventWait *w, SDL_Event *event, int timeout_ms) {
+  int ms = timeout_ms < 0 || timeout_ms > EVENT_WAIT_MAX_MS ? EVENT_WAIT_MAX_MS
+                                                            : timeout_ms;
+
+  if (!w->sem) {
+    if (!timeout_ms) {
+      return SDL_PollEvent(event);
+    }
+    int ret = SDL_WaitEventTimeout(event, ms);
+    w->wakeups++;
+    w->timeouts += !ret;
+    return ret;
+  }
+
+  // Posts for events the caller has already polled are stale. Dropped
+  // before looking at the queue, an event pushed after that still wakes
+  // the wait below
+  while (SDL_SemTryWait(w->sem) == 0) {
+  }
+  if (SDL_PollEvent(event)) {
+    return 1;
+  }
+  if (!timeout_ms) {
+    return 0;
+  }
+  SDL_SemWaitTimeout(w->sem, ms);
+  w->wakeups++;
+  if (SDL_PollEvent(event)) {
+    return 1;
+  }
+  w->timeouts++;
+  return 0;
+}
+
+void event_wait_until(int *timeout_ms, Uint32 deadline_ms) {
+  Uint32 now = SDL_GetTicks();
+  int left = SDL_TICKS_PASSED(now, deadline_ms) ? 0 : (int)(deadline_ms - now);
+
+  if (*timeout_ms < 0 || left < *timeout_ms) {
+    *timeout_ms = left;
+  }
+}
+
+Uint32 event_wait_register(void) {
+  return SDL_RegisterEvents(1);
+}
+
+void event_wait_post(Uint32 type, int code) {
+  SDL_Event event;
+
+  SDL_zero(event);
+  event.type = type;
+  event.user.code = code;
+  SDL_PushEvent(&event);
+}
+
+EventWaitStats event_wait_stats(EventWait *w) {
+  EventWaitStats st;
+
+  st.seconds = (SDL_GetTicks() - w->start_ms) / 1000.0;
+  st.wakeups = w->wakeups;
+  st.timeouts = w->timeouts;
+  st.wakeups_per_sec = st.seconds > 0 ? st.wakeups / st.seconds : 0.0;
+  return st;
+}
+
+void event_wait_print_stats(EventWait *w, const char *name) {
+  EventWaitStats st = event_wait_stats(w);
+
+  fprintf(stderr,
+          "%s: %llu wakeups in %.1f s (%.2f per second, %s), %llu without "
+          "an event\n",
+          name, (unsigned long long)st.wakeups, st.seconds, st.wakeups_per_sec,
+          w->sem ? "semaphore" : "SDL_WaitEventTimeout",
+          (unsigned long long)st.timeouts);
+}
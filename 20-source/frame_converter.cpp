@@ -0,0 +1,140 @@
+#include "frame_converter.h"
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+}
+#include <stdio.h>
+#include <string.h>
+
+void frame_converter_init(FrameConverter *conv) {
+  memset(conv, 0, sizeof(*conv));
+  conv->src_fmt = AV_PIX_FMT_NONE;
+  conv->dst_fmt = AV_PIX_FMT_NONE;
+}
+
+static void free_pool(FrameConverter *conv) {
+  for (int i = 0; i < FRAME_CONVERTER_POOL_SIZE; i++) {
+    av_freep(&conv->pool[i].data[0]);
+    memset(&conv->pool[i], 0, sizeof(conv->pool[i]));
+  }
+  conv->pool_next = 0;
+}
+
+static int rebuild(FrameConverter *conv, const AVFrame *frame, int dst_w,
+                   int dst_h, AVPixelFormat dst_fmt) {
+  int64_t start = av_gettime_relative();
+  int dst_changed =
+      dst_w != conv->dst_w || dst_h != conv->dst_h || dst_fmt != conv->dst_fmt;
+
+  conv->sws_ctx = sws_getCachedContext(
+      conv->sws_ctx, frame->width, frame->height, (AVPixelFormat)frame->format,
+      dst_w, dst_h, dst_fmt, SWS_BICUBIC, NULL, NULL, NULL);
+  if (!conv->sws_ctx) {
+    fprintf(stderr, "Error creating SwsContext\n");
+    return AVERROR(EINVAL);
+  }
+
+  // Output buffers only depend on the destination geometry
+  if (dst_changed || !conv->pool[0].data[0]) {
+    free_pool(conv);
+    for (int i = 0; i < FRAME_CONVERTER_POOL_SIZE; i++) {
+      int ret = av_image_alloc(conv->pool[i].data, conv->pool[i].linesize,
+                               dst_w, dst_h, dst_fmt, FRAME_CONVERTER_ALIGN);
+      if (ret < 0) {
+        fprintf(stderr, "Could not allocate conversion buffer\n");
+        free_pool(conv);
+        return ret;
+      }
+    }
+  }
+
+  conv->src_w = frame->width;
+  conv->src_h = frame->height;
+  conv->src_fmt = (AVPixelFormat)frame->format;
+  conv->dst_w = dst_w;
+  conv->dst_h = dst_h;
+  conv->dst_fmt = dst_fmt;
+  conv->rebuilds++;
+  conv->rebuild_us_total += av_gettime_relative() - start;
+
+  fprintf(stderr, "Converter configured: %dx%d %s -> %dx%d %s\n", conv->src_w,
+          conv->src_h, av_get_pix_fmt_name(conv->src_fmt), dst_w, dst_h,
+          av_get_pix_fmt_name(dst_fmt));
+  return 0;
+}
+
+int frame_converter_convert(FrameConverter *conv, const AVFrame *frame,
+                            int dst_w, int dst_h, AVPixelFormat dst_fmt,
+                            ConverterBuffer **out) {
+  if (!conv->sws_ctx || frame->width != conv->src_w ||
+      frame->height != conv->src_h || frame->format != conv->src_fmt ||
+      dst_w != conv->dst_w || dst_h != conv->dst_h || dst_fmt != conv->dst_fmt) {
+    int ret = rebuild(conv, frame, dst_w, dst_h, dst_fmt);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  int64_t start = av_gettime_relative();
+  ConverterBuffer *buf = &conv->pool[conv->pool_next];
+  conv->pool_next = (conv->pool_next + 1) % FRAME_CONVERTER_POOL_SIZE;
+
+  int ret = sws_scale(conv->sws_ctx, frame->data, frame->linesize, 0,
+                      frame->height, buf->data, buf->linesize);
+  if (ret < 0) {
+    fprintf(stderr, "Error during sws_scale\n");
+    return ret;
+  }
+
+  int64_t elapsed = av_gettime_relative() - start;
+  conv->frames++;
+  conv->convert_us_total += elapsed;
+  if (elapsed > conv->convert_us_max) {
+    conv->convert_us_max = elapsed;
+  }
+
+  *out = buf;
+  return 0;
+}
+
+int frame_converter_passthrough(FrameConverter *conv, const AVFrame *frame,
+                                int dst_w, int dst_h, AVPixelFormat dst_fmt) {
+  AVPixelFormat fmt = (AVPixelFormat)frame->format;
+
+  // YUVJ420P only differs in colour range, the plane layout is identical
+  if (dst_fmt == AV_PIX_FMT_YUV420P && fmt == AV_PIX_FMT_YUVJ420P) {
+    fmt = AV_PIX_FMT_YUV420P;
+  }
+  if (fmt != dst_fmt || frame->width != dst_w || frame->height != dst_h) {
+    return 0;
+  }
+  conv->passthrough++;
+  return 1;
+}
+
+void frame_converter_print_stats(const FrameConverter *conv) {
+  if (conv->passthrough > 0) {
+    fprintf(stderr, "Converter: %llu frames uploaded without conversion\n",
+            (unsigned long long)conv->passthrough);
+  }
+  if (conv->frames == 0) {
+    return;
+  }
+  fprintf(stderr,
+          "Converter: %llu frames, avg %.1f us, max %lld us, "
+          "%llu rebuilds (%.1f us total)\n",
+          (unsigned long long)conv->frames,
+          (double)conv->convert_us_total / conv->frames,
+          (long long)conv->convert_us_max, (unsigned long long)conv->rebuilds,
+          (double)conv->rebuild_us_total);
+}
+
+void frame_converter_free(FrameConverter *conv) {
+  free_pool(conv);
+  sws_freeContext(conv->sws_ctx);
+  conv->sws_ctx = NULL;
+}
@@ -0,0 +1,91 @@
+#include "frame_pacer.h"
+
+#include <SDL2/SDL.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __linux__
+#include <time.h>
+#endif
+
+// Upper bounds of the jitter histogram buckets in microseconds, the last
+// bucket collects everything above
+static const double kBucketLimitsUs[FRAME_PACER_HISTOGRAM_BUCKETS - 1] = {
+    10, 50, 100, 250, 500, 1000, 2000, 5000, 10000};
+
+double frame_pacer_now(void) {
+  static const double freq = (double)SDL_GetPerformanceFrequency();
+  return SDL_GetPerformanceCounter() / freq;
+}
+
+static void sleep_for(double seconds) {
+#ifdef __linux__
+  struct timespec ts;
+  ts.tv_sec = (time_t)seconds;
+  ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+  while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR) {
+  }
+#else
+  // Truncates to whole milliseconds, the caller loops or spins the rest
+  SDL_Delay((Uint32)(seconds * 1000));
+#endif
+}
+
+void frame_pacer_init(FramePacer *p, double spin_margin) {
+  memset(p, 0, sizeof(*p));
+  p->spin_margin = spin_margin > 0 ? spin_margin : 0;
+}
+
+void frame_pacer_wait_until(FramePacer *p, double deadline) {
+  double now = frame_pacer_now();
+
+  if (now >= deadline) {
+    p->late++;
+  } else {
+    // Sleep up to the spin margin, then busy-wait the last stretch
+    while (deadline - now > p->spin_margin) {
+      sleep_for(deadline - now - p->spin_margin);
+      now = frame_pacer_now();
+    }
+    while (now < deadline) {
+      now = frame_pacer_now();
+    }
+  }
+
+  double error = now - deadline;
+  double error_us = error * 1e6;
+  int bucket = 0;
+  while (bucket < FRAME_PACER_HISTOGRAM_BUCKETS - 1 &&
+         error_us > kBucketLimitsUs[bucket]) {
+    bucket++;
+  }
+  p->histogram[bucket]++;
+  p->waits++;
+  p->error_sum += error;
+  if (error > p->max_error) {
+    p->max_error = error;
+  }
+}
+
+void frame_pacer_print_stats(const FramePacer *p) {
+  if (p->waits == 0) {
+    return;
+  }
+  fprintf(stderr,
+          "Frame pacing: %llu waits, %llu already late, avg error %.1f us, "
+          "max %.1f us, spin %.0f us\n",
+          (unsigned long long)p->waits, (unsigned long long)p->late,
+          p->error_sum * 1e6 / p->waits, p->max_error * 1e6,
+          p->spin_margin * 1e6);
+  for (int i = 0; i < FRAME_PACER_HISTOGRAM_BUCKETS; i++) {
+    if (i < FRAME_PACER_HISTOGRAM_BUCKETS - 1) {
+      fprintf(stderr, "  <= %6.0f us: %8llu (%5.1f%%)\n", kBucketLimitsUs[i],
+              (unsigned long long)p->histogram[i],
+              100.0 * p->histogram[i] / p->waits);
+    } else {
+      fprintf(stderr, "   > %6.0f us: %8llu (%5.1f%%)\n",
+              kBucketLimitsUs[i - 1], (unsigned long long)p->histogram[i],
+              100.0 * p->histogram[i] / p->waits);
+    }
+  }
+}
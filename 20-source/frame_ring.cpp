@@ -0,0 +1,215 @@
+#include "frame_ring.h"
+
+#include <SDL2/SDL.h>
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+#include <stdio.h>
+
+// Wakes the other side if it announced that it is about to sleep. The fence
+// orders our index store before the flag load; the waiter orders its flag
+// store before re-reading our index, so one of the two always sees the other.
+static void wake_waiter(std::atomic<int> *waiting, SDL_sem *sem) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting->load(std::memory_order_relaxed) && waiting->exchange(0)) {
+    SDL_SemPost(sem);
+  }
+}
+
+// Raises |waiting| before the caller re-checks the ring for the last time.
+static void announce_wait(std::atomic<int> *waiting) {
+  waiting->store(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+// Lowers |waiting| when the waiter did not sleep after all. If the other
+// side already took the flag its post is on the way and must be consumed, or
+// the next wait would return at once.
+static void cancel_wait(std::atomic<int> *waiting, SDL_sem *sem) {
+  if (!waiting->exchange(0)) {
+    SDL_SemWait(sem);
+  }
+}
+
+int frame_ring_init(FrameRing *r, unsigned capacity) {
+  unsigned size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  r->not_full = SDL_CreateSemaphore(0);
+  r->not_empty = SDL_CreateSemaphore(0);
+  r->slots = (AVFrame **)av_mallocz(size * sizeof(*r->slots));
+  r->capacity = size;
+  r->mask = size - 1;
+  if (!r->not_full || !r->not_empty || !r->slots) {
+    frame_ring_destroy(r);
+    return AVERROR(ENOMEM);
+  }
+  for (unsigned i = 0; i < size; i++) {
+    r->slots[i] = av_frame_alloc();
+    if (!r->slots[i]) {
+      frame_ring_destroy(r);
+      return AVERROR(ENOMEM);
+    }
+  }
+
+  r->head.store(0);
+  r->tail.store(0);
+  r->producer_waiting.store(0);
+  r->consumer_waiting.store(0);
+  r->finished.store(0);
+  r->abort_request.store(0);
+  r->pushed.store(0);
+  r->full_waits.store(0);
+  r->max_depth.store(0);
+  r->empty_waits.store(0);
+  return 0;
+}
+
+void frame_ring_destroy(FrameRing *r) {
+  if (r->slots) {
+    for (unsigned i = 0; i < r->capacity; i++) {
+      av_frame_free(&r->slots[i]);
+    }
+    av_freep(&r->slots);
+  }
+  if (r->not_full) {
+    SDL_DestroySemaphore(r->not_full);
+    r->not_full = NULL;
+  }
+  if (r->not_empty) {
+    SDL_DestroySemaphore(r->not_empty);
+    r->not_empty = NULL;
+  }
+  r->capacity = 0;
+  r->mask = 0;
+}
+
+int frame_ring_try_push(FrameRing *r, AVFrame *frame) {
+  unsigned head = r->head.load(std::memory_order_relaxed);
+  unsigned tail = r->tail.load(std::memory_order_acquire);
+  if (head - tail == r->capacity) {
+    return AVERROR(EAGAIN);
+  }
+
+  av_frame_move_ref(r->slots[head & r->mask], frame);
+  r->head.store(head + 1, std::memory_order_release);
+  wake_waiter(&r->consumer_waiting, r->not_empty);
+
+  int depth = (int)(head + 1 - tail);
+  r->pushed.fetch_add(1, std::memory_order_relaxed);
+  if (depth > r->max_depth.load(std::memory_order_relaxed)) {
+    r->max_depth.store(depth, std::memory_order_relaxed);
+  }
+  return 0;
+}
+
+int frame_ring_try_pop(FrameRing *r, AVFrame *frame) {
+  unsigned tail = r->tail.load(std::memory_order_relaxed);
+  unsigned head = r->head.load(std::memory_order_acquire);
+  if (head == tail) {
+    if (!r->finished.load(std::memory_order_acquire)) {
+      return AVERROR(EAGAIN);
+    }
+    // The producer may have pushed its last frame just before finishing
+    head = r->head.load(std::memory_order_acquire);
+    if (head == tail) {
+      return AVERROR_EOF;
+    }
+  }
+
+  av_frame_move_ref(frame, r->slots[tail & r->mask]);
+  r->tail.store(tail + 1, std::memory_order_release);
+  wake_waiter(&r->producer_waiting, r->not_full);
+  return 0;
+}
+
+int frame_ring_push(FrameRing *r, AVFrame *frame) {
+  int waited = 0;
+
+  for (;;) {
+    if (r->abort_request.load(std::memory_order_acquire)) {
+      av_frame_unref(frame);
+      return AVERROR_EXIT;
+    }
+    if (frame_ring_try_push(r, frame) == 0) {
+      return 0;
+    }
+    if (!waited) {
+      waited = 1;
+      r->full_waits.fetch_add(1, std::memory_order_relaxed);
+    }
+    announce_wait(&r->producer_waiting);
+    if (r->abort_request.load(std::memory_order_acquire) ||
+        r->head.load(std::memory_order_relaxed) -
+                r->tail.load(std::memory_order_acquire) < r->capacity) {
+      cancel_wait(&r->producer_waiting, r->not_full);
+      continue;
+    }
+    SDL_SemWait(r->not_full);
+  }
+}
+
+int frame_ring_pop(FrameRing *r, AVFrame *frame, int timeout_ms) {
+  Uint32 start = SDL_GetTicks();
+  int waited = 0;
+
+  for (;;) {
+    if (r->abort_request.load(std::memory_order_acquire)) {
+      return AVERROR_EXIT;
+    }
+    int ret = frame_ring_try_pop(r, frame);
+    if (ret != AVERROR(EAGAIN)) {
+      return ret;
+    }
+    if (!waited) {
+      waited = 1;
+      r->empty_waits.fetch_add(1, std::memory_order_relaxed);
+    }
+    Uint32 elapsed = SDL_GetTicks() - start;
+    if (timeout_ms >= 0 && elapsed >= (Uint32)timeout_ms) {
+      return AVERROR(EAGAIN);
+    }
+    announce_wait(&r->consumer_waiting);
+    if (r->abort_request.load(std::memory_order_acquire) ||
+        r->finished.load(std::memory_order_acquire) ||
+        r->head.load(std::memory_order_acquire) !=
+            r->tail.load(std::memory_order_relaxed)) {
+      cancel_wait(&r->consumer_waiting, r->not_empty);
+      continue;
+    }
+    if (timeout_ms < 0) {
+      SDL_SemWait(r->not_empty);
+    } else if (SDL_SemWaitTimeout(r->not_empty, timeout_ms - elapsed) != 0) {
+      cancel_wait(&r->consumer_waiting, r->not_empty);
+    }
+  }
+}
+
+void frame_ring_finish(FrameRing *r) {
+  r->finished.store(1, std::memory_order_release);
+  wake_waiter(&r->consumer_waiting, r->not_empty);
+}
+
+void frame_ring_abort(FrameRing *r) {
+  r->abort_request.store(1, std::memory_order_release);
+  wake_waiter(&r->producer_waiting, r->not_full);
+  wake_waiter(&r->consumer_waiting, r->not_empty);
+}
+
+QueueStats frame_ring_stats(FrameRing *r) {
+  QueueStats stats;
+  // Tail first: the head can only move further ahead of it meanwhile
+  unsigned tail = r->tail.load(std::memory_order_acquire);
+  unsigned head = r->head.load(std::memory_order_acquire);
+
+  stats.capacity = (int)r->capacity;
+  stats.depth = (int)(head - tail);
+  stats.max_depth = r->max_depth.load(std::memory_order_relaxed);
+  stats.pushed = r->pushed.load(std::memory_order_relaxed);
+  stats.full_waits = r->full_waits.load(std::memory_order_relaxed);
+  stats.empty_waits = r->empty_waits.load(std::memory_order_relaxed);
+  return stats;
+}
@@ -0,0 +1,214 @@
+// Micro-benchmark: decoder -> renderer frame hand-off through the mutex based
+// FrameQueue versus the lock-free FrameRing.
+//
+// A producer thread pushes 1080p YUV420P frame references as fast as the
+// queue accepts them (a decoder running ahead), the main thread pops them at
+// a fixed display rate like the render loop does. For every frame it records
+// the time spent inside the pop call and how late the frame was in hand
+// relative to its display deadline.
+//
+// The paced case turns this around: the producer pushes at the display rate
+// (a decoder that only just keeps up) and the consumer pops right away, so
+// every pop waits on an empty queue. It records the wake latency from the
+// push to the pop returning.
+//
+// Usage: frame_ring_bench [seconds per rate]
+#include <SDL2/SDL.h>
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/frame.h>
+}
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "av_queue.h"
+#include "frame_ring.h"
+
+#define BENCH_QUEUE_SIZE 4
+
+typedef struct {
+  int use_ring;
+  int paced_fps;  // 0: the producer runs ahead
+  FrameQueue queue;
+  FrameRing ring;
+  AVFrame *source;
+  std::atomic<int> stop;
+} BenchState;
+
+// Sleep coarsely, then spin onto |deadline|
+static void wait_until(Uint64 deadline, Uint64 freq) {
+  Uint64 now = SDL_GetPerformanceCounter();
+  if (deadline > now) {
+    Uint32 ms = (Uint32)((deadline - now) * 1000 / freq);
+    if (ms > 1) {
+      SDL_Delay(ms - 1);
+    }
+    while (SDL_GetPerformanceCounter() < deadline) {
+    }
+  }
+}
+
+static int producer_thread(void *arg) {
+  BenchState *bs = (BenchState *)arg;
+  AVFrame *frame = av_frame_alloc();
+  const Uint64 freq = SDL_GetPerformanceFrequency();
+  Uint64 start = SDL_GetPerformanceCounter();
+
+  for (Uint64 i = 0; frame && !bs->stop.load(); i++) {
+    // New reference to the same buffers, as a decoder would hand out
+    if (av_frame_ref(frame, bs->source) < 0) {
+      break;
+    }
+    if (bs->paced_fps) {
+      wait_until(start + i * freq / bs->paced_fps, freq);
+    }
+    // The consumer measures the wake latency from here
+    frame->pts = (int64_t)SDL_GetPerformanceCounter();
+    int ret = bs->use_ring ? frame_ring_push(&bs->ring, frame)
+                           : frame_queue_put(&bs->queue, frame);
+    if (ret < 0) {
+      break;
+    }
+  }
+  av_frame_free(&frame);
+  return 0;
+}
+
+static double percentile(std::vector<double> &v, double p) {
+  std::sort(v.begin(), v.end());
+  size_t idx = (size_t)(p * (v.size() - 1));
+  return v[idx];
+}
+
+static int run(BenchState *bs, int use_ring, int paced, int fps,
+               int seconds) {
+  const Uint64 freq = SDL_GetPerformanceFrequency();
+  const Uint64 period = freq / fps;
+  const int frames = fps * seconds;
+  std::vector<double> handoff_us, late_us;
+  int ret;
+
+  bs->use_ring = use_ring;
+  bs->paced_fps = paced ? fps : 0;
+  bs->stop.store(0);
+  ret = use_ring ? frame_ring_init(&bs->ring, BENCH_QUEUE_SIZE)
+                 : frame_queue_init(&bs->queue, BENCH_QUEUE_SIZE);
+  if (ret < 0) {
+    fprintf(stderr, "Could not allocate the %s queue\n",
+            use_ring ? "ring" : "mutex");
+    return ret;
+  }
+  AVFrame *frame = av_frame_alloc();
+  SDL_Thread *tid = frame ? SDL_CreateThread(producer_thread, "Producer", bs)
+                          : NULL;
+  if (!tid) {
+    fprintf(stderr, "Could not start the producer\n");
+    ret = AVERROR(ENOMEM);
+  }
+
+  handoff_us.reserve(frames);
+  late_us.reserve(frames);
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (int i = 0; tid && i < frames; i++) {
+    Uint64 deadline = start + (Uint64)i * period;
+
+    // Paced: the consumer is always ready and waits for the producer
+    if (!paced) {
+      wait_until(deadline, freq);
+    }
+
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    ret = use_ring ? frame_ring_pop(&bs->ring, frame, -1)
+                   : frame_queue_get(&bs->queue, frame, -1);
+    Uint64 t1 = SDL_GetPerformanceCounter();
+    if (ret < 0) {
+      break;
+    }
+    Uint64 pushed = (Uint64)frame->pts;
+    av_frame_unref(frame);
+
+    // Paced: wake latency from the push instead of lateness to a deadline
+    Uint64 due = paced ? pushed : deadline;
+    handoff_us.push_back((double)(t1 - t0) * 1e6 / freq);
+    late_us.push_back(t1 > due ? (double)(t1 - due) * 1e6 / freq : 0.0);
+  }
+
+  bs->stop.store(1);
+  if (use_ring) {
+    frame_ring_abort(&bs->ring);
+  } else {
+    frame_queue_abort(&bs->queue);
+  }
+  if (tid) {
+    SDL_WaitThread(tid, NULL);
+  }
+  if (use_ring) {
+    frame_ring_destroy(&bs->ring);
+  } else {
+    frame_queue_destroy(&bs->queue);
+  }
+  av_frame_free(&frame);
+
+  if (ret < 0) {
+    return ret;
+  }
+  double sum = 0;
+  for (double v : handoff_us) {
+    sum += v;
+  }
+  double avg = sum / handoff_us.size();
+  double p99 = percentile(handoff_us, 0.99);
+  double max = handoff_us.back();
+  double late_p50 = percentile(late_us, 0.50);
+  double late_p99 = percentile(late_us, 0.99);
+
+  printf("%4d fps  %-6s  pop avg %7.2f us  p99 %7.2f us  max %8.2f us  "
+         "%s p50 %7.2f us  p99 %8.2f us\n",
+         fps, use_ring ? "ring" : "mutex", avg, p99, max,
+         paced ? "wake" : "late", late_p50, late_p99);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 5;
+  static const int rates[] = {60, 120, 240};
+  BenchState bs;
+
+  if (seconds <= 0) {
+    fprintf(stderr, "Usage: %s [seconds per rate]\n", argv[0]);
+    return -1;
+  }
+  if (SDL_Init(SDL_INIT_TIMER) < 0) {
+    fprintf(stderr, "SDL initialization failed: %s\n", SDL_GetError());
+    return -1;
+  }
+
+  bs.source = av_frame_alloc();
+  bs.source->format = AV_PIX_FMT_YUV420P;
+  bs.source->width = 1920;
+  bs.source->height = 1080;
+  if (av_frame_get_buffer(bs.source, 32) < 0) {
+    fprintf(stderr, "Could not allocate source frame\n");
+    return -1;
+  }
+
+  int ret = 0;
+  for (int paced = 0; paced <= 1 && ret >= 0; paced++) {
+    printf(paced ? "paced producer, consumer waits on an empty queue:\n"
+                 : "free-running producer, paced consumer:\n");
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]) && ret >= 0; i++) {
+      ret = run(&bs, 0, paced, rates[i], seconds);
+      if (ret >= 0) {
+        ret = run(&bs, 1, paced, rates[i], seconds);
+      }
+    }
+  }
+
+  av_frame_free(&bs.source);
+  SDL_Quit();
+  return ret < 0 ? -1 : 0;
+}
@@ -2,16 +2,168 @@
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/cpu.h>
 #include <libavutil/frame.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/time.h>
 #include <libswscale/swscale.h>
 }
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "audio_output.h"
+#include "av_queue.h"
+#include "decode_bench.h"
+#include "event_wait.h"
+#include "frame_converter.h"
+#include "frame_pacer.h"
+#include "frame_ring.h"
+#include "media_clock.h"
+
+// Queue depths between the pipeline stages. Packets are small, decoded
+// frames are not, so only a few frames are buffered ahead of the renderer.
+#define VIDEO_PACKET_QUEUE_SIZE 64
+#define VIDEO_FRAME_QUEUE_SIZE 4
+// Compressed audio frames are tiny, keep a few seconds so the demuxer can
+// run ahead on video without starving the audio device
+#define AUDIO_PACKET_QUEUE_SIZE 256
+// Interval between runtime queue statistics
+#define STATS_INTERVAL_MS 5000
+
+// Audio is resampled towards the master clock once it drifts further than
+// this, in seconds
+#define AV_SYNC_THRESHOLD 0.04
+// Beyond this the clocks are considered unrelated (e.g. broken timestamps)
+// and no correction is attempted, in seconds
+#define AV_NOSYNC_THRESHOLD 10.0
+// Longest single wait for a frame that is early against the master clock
+#define AV_SYNC_MAX_WAIT 1.0
+
+typedef enum {
+  SYNC_AUDIO_MASTER,    // video follows the audio device (default)
+  SYNC_VIDEO_MASTER,    // video paced by its own timestamps
+  SYNC_EXTERNAL_CLOCK,  // both follow a free running wall clock
+} SyncMode;
+
+typedef struct {
+  uint64_t frames;
+  uint64_t dropped;  // frames that were too late to show
+  double last_drift;
+  double abs_drift_sum;
+  double max_abs_drift;
+} SyncStats;
+
+typedef struct {
+  int thread_count;  // decoder threads, 0 = one per core
+  int thread_type;   // FF_THREAD_FRAME and/or FF_THREAD_SLICE
+} DecoderOptions;
+
+typedef struct {
+  AVFormatContext *format_ctx;
+  AVCodecContext *codec_ctx;
+  int video_stream_index;
+  PacketQueue video_packets;
+  FrameRing video_frames;  // lock-free hand-off from decoder to renderer
+  Uint32 frame_event;      // posted by the decoder to wake the render loop
+
+  // Audio, only set up when the file has a playable audio stream
+  AVCodecContext *audio_ctx;
+  int audio_stream_index;
+  PacketQueue audio_packets;
+  AudioOutput audio;
+
+  SyncMode sync_mode;
+  MediaClock audio_clock;
+  MediaClock video_clock;
+  MediaClock external_clock;
+  SyncStats sync;
+} PlayerState;
+
+// One decoding stage: packets in, frames handed on through |emit|
+typedef struct {
+  const char *name;
+  AVCodecContext *codec_ctx;
+  PacketQueue *packets;
+  // Returns AVERROR_EXIT when the pipeline is shutting down
+  int (*emit)(PlayerState *ps, AVFrame *frame);
+} DecoderStage;
+
+typedef struct {
+  SDL_Renderer *renderer;
+  SDL_Texture *texture;
+  int tex_w;
+  int tex_h;
+  AVRational sar;
+  SDL_Rect dst_rect;  // letterboxed picture area within the output
+  int dst_rect_valid;
+} VideoDisplay;
+
+static const char *thread_type_name(int thread_type) {
+  switch (thread_type) {
+    case FF_THREAD_FRAME:
+      return "frame";
+    case FF_THREAD_SLICE:
+      return "slice";
+    case FF_THREAD_FRAME | FF_THREAD_SLICE:
+      return "frame+slice";
+    default:
+      return "no";
+  }
+}
+
+static const char *sync_mode_name(SyncMode mode) {
+  switch (mode) {
+    case SYNC_AUDIO_MASTER:
+      return "audio";
+    case SYNC_VIDEO_MASTER:
+      return "video";
+    default:
+      return "external";
+  }
+}
+
+static int parse_sync_mode(const char *name, SyncMode *mode) {
+  if (!strcmp(name, "audio")) {
+    *mode = SYNC_AUDIO_MASTER;
+  } else if (!strcmp(name, "video")) {
+    *mode = SYNC_VIDEO_MASTER;
+  } else if (!strcmp(name, "ext") || !strcmp(name, "external")) {
+    *mode = SYNC_EXTERNAL_CLOCK;
+  } else {
+    return -1;
+  }
+  return 0;
+}
 
-void initFFmpeg(const char *filename, AVCodecContext **codec_ctx,
-                AVFrame **frame, AVFormatContext **format_ctx,
-                AVCodec **codec) {
+static MediaClock *master_clock(PlayerState *ps) {
+  switch (ps->sync_mode) {
+    case SYNC_AUDIO_MASTER:
+      return &ps->audio_clock;
+    case SYNC_VIDEO_MASTER:
+      return &ps->video_clock;
+    default:
+      return &ps->external_clock;
+  }
+}
+
+static int parse_thread_type(const char *name, int *thread_type) {
+  if (!strcmp(name, "frame")) {
+    *thread_type = FF_THREAD_FRAME;
+  } else if (!strcmp(name, "slice")) {
+    *thread_type = FF_THREAD_SLICE;
+  } else if (!strcmp(name, "both")) {
+    *thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+void initFFmpeg(const char *filename, const DecoderOptions *opts,
+                AVCodecContext **codec_ctx, AVFrame **frame,
+                AVFormatContext **format_ctx, AVCodec **codec) {
   // Open the input file with FFmpeg
   if (avformat_open_input(format_ctx, filename, NULL, NULL) < 0) {
     fprintf(stderr, "Could not open input file\n");
@@ -59,11 +211,21 @@ void initFFmpeg(const char *filename, AVCodecContext **codec_ctx,
     exit(1);
   }
 
+  // Spread decoding over the cores; frame threading adds thread_count
+  // frames of latency, slice threading depends on how the stream was coded
+  (*codec_ctx)->thread_count =
+      opts->thread_count > 0 ? opts->thread_count : av_cpu_count();
+  (*codec_ctx)->thread_type = opts->thread_type;
+
   if (avcodec_open2(*codec_ctx, *codec, NULL) < 0) {
     fprintf(stderr, "Could not open codec\n");
     exit(1);
   }
 
+  fprintf(stderr, "Decoder %s: %d threads, %s threading\n", (*codec)->name,
+          (*codec_ctx)->thread_count,
+          thread_type_name((*codec_ctx)->active_thread_type));
+
   *frame = av_frame_alloc();
   if (!*frame) {
     fprintf(stderr, "Could not allocate frame\n");
@@ -71,149 +233,491 @@ void initFFmpeg(const char *filename, AVCodecContext **codec_ctx,
   }
 }
 
-void renderFrame(SDL_Renderer *renderer, SDL_Texture *texture, AVFrame *frame) {
-  // Create a SwsContext for pixel format conversion
-  struct SwsContext *sws_ctx = sws_getContext(
-      frame->width, frame->height, (AVPixelFormat)frame->format, frame->width,
-      frame->height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, NULL, NULL, NULL);
+// Open the decoder of the best audio stream. Unlike the video path a failure
+// is not fatal, playback then simply continues without sound.
+static int openAudioDecoder(PlayerState *ps) {
+  const AVCodec *codec = NULL;
+  int index = av_find_best_stream(ps->format_ctx, AVMEDIA_TYPE_AUDIO, -1,
+                                  ps->video_stream_index, &codec, 0);
+  if (index < 0) {
+    fprintf(stderr, "No audio stream, playing video only\n");
+    return index;
+  }
 
-  fprintf(stderr, "frame->width: %d, frame->height: %d\n", frame->width,
-          frame->height);
-  if (!sws_ctx) {
-    fprintf(stderr, "Error creating SwsContext\n");
-    return;
+  AVStream *stream = ps->format_ctx->streams[index];
+  ps->audio_ctx = avcodec_alloc_context3(codec);
+  if (!ps->audio_ctx ||
+      avcodec_parameters_to_context(ps->audio_ctx, stream->codecpar) < 0 ||
+      avcodec_open2(ps->audio_ctx, codec, NULL) < 0) {
+    fprintf(stderr, "Could not open audio decoder, playing video only\n");
+    avcodec_free_context(&ps->audio_ctx);
+    return AVERROR_DECODER_NOT_FOUND;
   }
+  ps->audio_ctx->pkt_timebase = stream->time_base;
+  ps->audio_stream_index = index;
+
+  fprintf(stderr, "Audio decoder %s: %d Hz, %d channels\n", codec->name,
+          ps->audio_ctx->sample_rate, ps->audio_ctx->ch_layout.nb_channels);
+  return 0;
+}
 
-  // Allocate memory for the converted frame
-  uint8_t *yuv_buffer = (uint8_t *)malloc(frame->width * frame->height * 3 / 2);
-  if (yuv_buffer == NULL) {
-    fprintf(stderr, "Memory allocation failed for yuv_buffer\n");
-    sws_freeContext(sws_ctx);
+// (Re)create the texture when the stream geometry changes, e.g. on a
+// mid-stream resolution switch. The texture always matches the decoded
+// picture so uploads never have to be scaled.
+static int configureDisplay(VideoDisplay *disp, const AVFrame *frame) {
+  if (disp->texture && frame->width == disp->tex_w &&
+      frame->height == disp->tex_h &&
+      frame->sample_aspect_ratio.num == disp->sar.num &&
+      frame->sample_aspect_ratio.den == disp->sar.den) {
+    return 0;
+  }
+
+  if (!disp->texture || frame->width != disp->tex_w ||
+      frame->height != disp->tex_h) {
+    if (disp->texture) {
+      SDL_DestroyTexture(disp->texture);
+    }
+    disp->texture =
+        SDL_CreateTexture(disp->renderer, SDL_PIXELFORMAT_IYUV,
+                          SDL_TEXTUREACCESS_STREAMING, frame->width,
+                          frame->height);
+    if (disp->texture == NULL) {
+      fprintf(stderr, "Texture creation failed: %s\n", SDL_GetError());
+      return -1;
+    }
+    fprintf(stderr, "Video texture: %dx%d\n", frame->width, frame->height);
+  }
+
+  disp->tex_w = frame->width;
+  disp->tex_h = frame->height;
+  disp->sar = frame->sample_aspect_ratio;
+  disp->dst_rect_valid = 0;
+  return 0;
+}
+
+// Fit the picture into the output while keeping its display aspect ratio.
+// Only runs after a resize or a stream geometry change.
+static void updateDisplayRect(VideoDisplay *disp) {
+  int out_w = 0, out_h = 0;
+  double aspect = (double)disp->tex_w / disp->tex_h;
+
+  SDL_GetRendererOutputSize(disp->renderer, &out_w, &out_h);
+  if (disp->sar.num > 0 && disp->sar.den > 0) {
+    aspect *= av_q2d(disp->sar);
+  }
+
+  int w = out_w;
+  int h = (int)(w / aspect + 0.5);
+  if (h > out_h) {
+    h = out_h;
+    w = (int)(h * aspect + 0.5);
+  }
+
+  disp->dst_rect.x = (out_w - w) / 2;
+  disp->dst_rect.y = (out_h - h) / 2;
+  disp->dst_rect.w = w;
+  disp->dst_rect.h = h;
+  disp->dst_rect_valid = 1;
+}
+
+void renderFrame(VideoDisplay *disp, FrameConverter *conv, AVFrame *frame) {
+  int ret;
+
+  if (configureDisplay(disp, frame) < 0) {
     return;
+  }
+  if (!disp->dst_rect_valid) {
+    updateDisplayRect(disp);
+  }
+
+  if (frame_converter_passthrough(conv, frame, disp->tex_w, disp->tex_h,
+                                  AV_PIX_FMT_YUV420P)) {
+    // Decoder output already matches the texture, upload the planes as is
+    ret = SDL_UpdateYUVTexture(disp->texture, NULL, frame->data[0],
+                               frame->linesize[0], frame->data[1],
+                               frame->linesize[1], frame->data[2],
+                               frame->linesize[2]);
   } else {
-    fprintf(stderr, "Allocated buffer size: %d bytes\n",
-            frame->width * frame->height * 3 / 2);
-  }
-  int width = frame->width;
-  int height = frame->height;
-
-  int y_size = width * height;
-  int uv_size = y_size / 4;
-
-  // Set YUV plane pointers
-  uint8_t *yuv_planes[3] = {
-      yuv_buffer,                    // Y plane
-      yuv_buffer + y_size,           // U plane
-      yuv_buffer + y_size + uv_size  // V plane
-  };
-
-  int yuv_linesize[3] = {
-      width,      // Y stride
-      width / 2,  // U stride
-      width / 2   // V stride
-  };
-
-  // Now call sws_scale
-  int ret = sws_scale(sws_ctx, frame->data, frame->linesize, 0, height,
-                      yuv_planes, yuv_linesize);
-
-  if (ret < 0) {
-    fprintf(stderr, "Error during sws_scale\n");
-    free(yuv_buffer);
-    sws_freeContext(sws_ctx);
+    ConverterBuffer *yuv = NULL;
+
+    // Convert into a pooled buffer; the scaler is only rebuilt when the
+    // stream geometry or pixel format changes
+    ret = frame_converter_convert(conv, frame, disp->tex_w, disp->tex_h,
+                                  AV_PIX_FMT_YUV420P, &yuv);
+    if (ret < 0) {
+      return;
+    }
+
+    ret = SDL_UpdateYUVTexture(disp->texture, NULL, yuv->data[0],
+                               yuv->linesize[0], yuv->data[1],
+                               yuv->linesize[1], yuv->data[2],
+                               yuv->linesize[2]);
+  }
+  if (ret != 0) {
+    fprintf(stderr, "SDL_UpdateYUVTexture failed: %s\n", SDL_GetError());
     return;
   }
 
-  // Update the SDL texture with the converted frame
-  ret = SDL_UpdateTexture(texture, NULL, yuv_buffer, frame->width);
-  if (ret != 0) {
-    fprintf(stderr, "SDL_UpdateTexture failed: %s\n", SDL_GetError());
-    free(yuv_buffer);
-    sws_freeContext(sws_ctx);
+  // Render the texture to the window, letterboxed
+  SDL_RenderClear(disp->renderer);
+  SDL_RenderCopy(disp->renderer, disp->texture, NULL, &disp->dst_rect);
+  SDL_RenderPresent(disp->renderer);
+}
+
+// Demux stage: read the container and queue the audio and video packets
+static int demux_thread(void *arg) {
+  PlayerState *ps = (PlayerState *)arg;
+  AVPacket *pkt = av_packet_alloc();
+  if (!pkt) {
+    fprintf(stderr, "Could not allocate packet\n");
+    packet_queue_finish(&ps->video_packets);
+    if (ps->audio_ctx) {
+      packet_queue_finish(&ps->audio_packets);
+    }
+    return -1;
+  }
+
+  while (av_read_frame(ps->format_ctx, pkt) >= 0) {
+    PacketQueue *q = NULL;
+    if (pkt->stream_index == ps->video_stream_index) {
+      q = &ps->video_packets;
+    } else if (ps->audio_ctx && pkt->stream_index == ps->audio_stream_index) {
+      q = &ps->audio_packets;
+    }
+    if (!q) {
+      av_packet_unref(pkt);
+      continue;
+    }
+    // Blocks while the decoder is behind
+    if (packet_queue_put(q, pkt) == AVERROR_EXIT) {
+      break;
+    }
+  }
+
+  packet_queue_finish(&ps->video_packets);
+  if (ps->audio_ctx) {
+    packet_queue_finish(&ps->audio_packets);
+  }
+  av_packet_free(&pkt);
+  return 0;
+}
+
+// Decode stage: turn queued packets into frames for the next stage.
+//
+// The decoder may hold several frames back (B-frame reordering) and may
+// refuse input until its output has been drained, so every packet is
+// followed by draining all ready frames, a packet rejected with EAGAIN is
+// kept and resent, and at end of stream a NULL packet flushes the frames
+// still buffered inside the decoder.
+static int run_decoder(PlayerState *ps, const DecoderStage *stage) {
+  AVPacket *pkt = av_packet_alloc();
+  AVFrame *frame = av_frame_alloc();
+  uint64_t packets = 0, frames = 0;
+  int64_t decode_us = 0;  // time spent inside the decoder
+  int pending = 0;   // pkt holds a packet the decoder has not accepted yet
+  int flushing = 0;  // end of stream reached, draining the decoder
+  int ret;
+
+  if (!pkt || !frame) {
+    fprintf(stderr, "Could not allocate decode buffers\n");
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+    return -1;
+  }
+
+  for (;;) {
+    if (!pending && !flushing) {
+      ret = packet_queue_get(stage->packets, pkt, -1);
+      if (ret == AVERROR_EXIT) {
+        break;
+      } else if (ret == AVERROR_EOF) {
+        flushing = 1;
+      } else {
+        pending = 1;
+        packets++;
+      }
+    }
+
+    int64_t start = av_gettime_relative();
+    ret = avcodec_send_packet(stage->codec_ctx, flushing ? NULL : pkt);
+    decode_us += av_gettime_relative() - start;
+    if (ret == AVERROR(EAGAIN)) {
+      // Output has to be drained first, the packet stays pending
+    } else {
+      if (ret < 0 && ret != AVERROR_EOF) {
+        // A corrupt packet should not end playback, drop it and go on
+        fprintf(stderr, "Error sending packet to decoder\n");
+      }
+      if (pending) {
+        av_packet_unref(pkt);
+        pending = 0;
+      }
+    }
+
+    for (;;) {
+      start = av_gettime_relative();
+      ret = avcodec_receive_frame(stage->codec_ctx, frame);
+      decode_us += av_gettime_relative() - start;
+      if (ret < 0) {
+        break;
+      }
+      frames++;
+      if (stage->emit(ps, frame) == AVERROR_EXIT) {
+        goto end;
+      }
+    }
+    if (ret == AVERROR_EOF) {
+      break;  // decoder fully flushed
+    } else if (ret != AVERROR(EAGAIN)) {
+      fprintf(stderr, "Error during decoding\n");
+      break;
+    }
+  }
+
+end:
+  // Throughput the decoder could sustain, excluding time spent waiting on
+  // the demuxer or the renderer
+  fprintf(stderr,
+          "%s: decoded %llu frames from %llu packets, %.1f fps decode\n",
+          stage->name, (unsigned long long)frames,
+          (unsigned long long)packets,
+          decode_us > 0 ? frames * 1e6 / decode_us : 0.0);
+  av_packet_unref(pkt);
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+  return 0;
+}
+
+static int emit_video_frame(PlayerState *ps, AVFrame *frame) {
+  int ret = frame_ring_push(&ps->video_frames, frame);
+  if (ret == 0) {
+    event_wait_post(ps->frame_event, 0);
+  }
+  return ret;
+}
+
+static int emit_audio_frame(PlayerState *ps, AVFrame *frame) {
+  AVRational tb = ps->format_ctx->streams[ps->audio_stream_index]->time_base;
+  double pts = frame->best_effort_timestamp == AV_NOPTS_VALUE
+                   ? NAN
+                   : frame->best_effort_timestamp * av_q2d(tb);
+
+  // When audio is not the master, stretch or squeeze it towards the master
+  // clock by resampling instead of dropping or inserting samples
+  if (ps->sync_mode != SYNC_AUDIO_MASTER) {
+    double diff = media_clock_get(&ps->audio_clock) -
+                  media_clock_get(master_clock(ps));
+    if (!isnan(diff) && fabs(diff) > AV_SYNC_THRESHOLD &&
+        fabs(diff) < AV_NOSYNC_THRESHOLD) {
+      audio_output_compensate(&ps->audio, frame->nb_samples, diff);
+    }
+  }
+
+  int ret = audio_output_write(&ps->audio, frame, pts);
+  av_frame_unref(frame);
+  return ret;
+}
+
+static int video_decode_thread(void *arg) {
+  PlayerState *ps = (PlayerState *)arg;
+  DecoderStage stage = {"Video", ps->codec_ctx, &ps->video_packets,
+                        emit_video_frame};
+  int ret = run_decoder(ps, &stage);
+  frame_ring_finish(&ps->video_frames);
+  event_wait_post(ps->frame_event, 0);
+  return ret;
+}
+
+static int audio_decode_thread(void *arg) {
+  PlayerState *ps = (PlayerState *)arg;
+  DecoderStage stage = {"Audio", ps->audio_ctx, &ps->audio_packets,
+                        emit_audio_frame};
+  int ret = run_decoder(ps, &stage);
+  audio_output_finish(&ps->audio);
+  return ret;
+}
+
+// Record how far the shown frame is from the other clock: the master, or
+// the audio clock when video is the master
+static void update_sync_stats(PlayerState *ps, double pts) {
+  MediaClock *ref = ps->sync_mode == SYNC_VIDEO_MASTER ? &ps->audio_clock
+                                                       : master_clock(ps);
+  double drift = pts - media_clock_get(ref);
+  if (isnan(drift) || fabs(drift) > AV_NOSYNC_THRESHOLD) {
     return;
   }
+  ps->sync.frames++;
+  ps->sync.last_drift = drift;
+  ps->sync.abs_drift_sum += fabs(drift);
+  if (fabs(drift) > ps->sync.max_abs_drift) {
+    ps->sync.max_abs_drift = fabs(drift);
+  }
+}
+
+static void print_stats(PlayerState *ps) {
+  QueueStats stats = packet_queue_stats(&ps->video_packets);
+  queue_stats_print("Video packet", &stats);
+  stats = frame_ring_stats(&ps->video_frames);
+  queue_stats_print("Video frame", &stats);
+  if (ps->audio_ctx) {
+    stats = packet_queue_stats(&ps->audio_packets);
+    queue_stats_print("Audio packet", &stats);
+  }
 
-  // Render the texture to the window
-  SDL_RenderClear(renderer);
-  SDL_RenderCopy(renderer, texture, NULL, NULL);
-  SDL_RenderPresent(renderer);
+  SyncStats *sync = &ps->sync;
+  fprintf(stderr,
+          "A/V sync (%s master): drift %+.1f ms, avg %.1f ms, max %.1f ms, "
+          "%llu frames dropped, %llu audio underruns\n",
+          sync_mode_name(ps->sync_mode), sync->last_drift * 1000,
+          sync->frames ? sync->abs_drift_sum * 1000 / sync->frames : 0.0,
+          sync->max_abs_drift * 1000, (unsigned long long)sync->dropped,
+          (unsigned long long)audio_ring_stats(&ps->audio.ring).underruns);
+}
 
-  // Free the YUV buffer after use
-  free(yuv_buffer);
-  sws_freeContext(sws_ctx);
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [--threads N] [--thread-type frame|slice|both] "
+          "[--sync audio|video|ext] [--spin-us N] [--bench [--bench-upload]] "
+          "<input file>\n",
+          prog);
 }
 
 int main(int argc, char **argv) {
-  if (argc <= 1) {
-    fprintf(stderr, "Usage: %s <input file>\n", argv[0]);
+  const char *filename = NULL;
+  DecoderOptions dec_opts = {0, FF_THREAD_FRAME | FF_THREAD_SLICE};
+  SyncMode sync_mode = SYNC_AUDIO_MASTER;
+  double spin_margin = FRAME_PACER_DEFAULT_SPIN;
+  int bench = 0;
+  DecodeBenchOptions bench_opts = {0};
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      dec_opts.thread_count = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--thread-type") && i + 1 < argc) {
+      if (parse_thread_type(argv[++i], &dec_opts.thread_type) < 0) {
+        usage(argv[0]);
+        return -1;
+      }
+    } else if (!strcmp(argv[i], "--sync") && i + 1 < argc) {
+      if (parse_sync_mode(argv[++i], &sync_mode) < 0) {
+        usage(argv[0]);
+        return -1;
+      }
+    } else if (!strcmp(argv[i], "--spin-us") && i + 1 < argc) {
+      spin_margin = atoi(argv[++i]) / 1e6;
+    } else if (!strcmp(argv[i], "--bench")) {
+      bench = 1;
+    } else if (!strcmp(argv[i], "--bench-upload")) {
+      bench = 1;
+      bench_opts.upload = 1;
+    } else if (!filename) {
+      filename = argv[i];
+    } else {
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if (!filename) {
+    usage(argv[0]);
     return -1;
   }
 
-  const char *filename = argv[1];
-  AVFormatContext *format_ctx = NULL;
-  AVCodecContext *codec_ctx = NULL;
+  PlayerState ps = {0};
   AVFrame *frame = NULL;
   AVCodec *codec = NULL;
-  AVPacket pkt;
   SDL_Window *window = NULL;
-  SDL_Renderer *renderer = NULL;
-  SDL_Texture *texture = NULL;
+  VideoDisplay display = {0};
+  SDL_Thread *demux_tid = NULL;
+  SDL_Thread *decode_tid = NULL;
+  SDL_Thread *audio_tid = NULL;
+  FrameConverter converter;
+  FramePacer pacer;
   int isRunning = 1;
+  int eof = 0;
   SDL_Event event;
+  EventWait waiter;
 
-  // Initialize SDL
-  if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+  // Initialize SDL; the benchmark runs headless and only brings up video
+  // itself when it measures the texture upload
+  if (SDL_Init(bench ? 0 : SDL_INIT_VIDEO) < 0) {
     fprintf(stderr, "SDL initialization failed: %s\n", SDL_GetError());
     return -1;
   }
 
-  // Create SDL window and renderer
-  window =
-      SDL_CreateWindow("MP4 Player", SDL_WINDOWPOS_UNDEFINED,
-                       SDL_WINDOWPOS_UNDEFINED, 1280, 720, SDL_WINDOW_SHOWN);
+  frame_converter_init(&converter);
+  frame_pacer_init(&pacer, spin_margin);
+  media_clock_init(&ps.audio_clock);
+  media_clock_init(&ps.video_clock);
+  media_clock_init(&ps.external_clock);
+
+  // Initialize FFmpeg
+  initFFmpeg(filename, &dec_opts, &ps.codec_ctx, &frame, &ps.format_ctx,
+             &codec);
+
+  // Find correct video stream index again
+  ps.video_stream_index = -1;
+  for (int i = 0; i < ps.format_ctx->nb_streams; i++) {
+    if (ps.format_ctx->streams[i]->codecpar->codec_type ==
+            AVMEDIA_TYPE_VIDEO &&
+        !(ps.format_ctx->streams[i]->disposition &
+          AV_DISPOSITION_ATTACHED_PIC)) {
+      ps.video_stream_index = i;
+      break;
+    }
+  }
+  if (ps.video_stream_index == -1) {
+    fprintf(stderr, "Could not find video stream\n");
+    return -1;
+  }
+
+  if (bench) {
+    int ret = decode_bench_run(&bench_opts, ps.format_ctx, ps.codec_ctx,
+                               ps.video_stream_index);
+    frame_converter_free(&converter);
+    av_frame_free(&frame);
+    avcodec_free_context(&ps.codec_ctx);
+    avformat_close_input(&ps.format_ctx);
+    SDL_Quit();
+    return ret < 0 ? -1 : 0;
+  }
+
+  // Create SDL window and renderer, sized to the stream
+  int window_w = ps.codec_ctx->width > 0 ? ps.codec_ctx->width : 1280;
+  int window_h = ps.codec_ctx->height > 0 ? ps.codec_ctx->height : 720;
+  window = SDL_CreateWindow("MP4 Player", SDL_WINDOWPOS_UNDEFINED,
+                            SDL_WINDOWPOS_UNDEFINED, window_w, window_h,
+                            SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
   if (window == NULL) {
     fprintf(stderr, "Window creation failed: %s\n", SDL_GetError());
     SDL_Quit();
     return -1;
   }
 
-  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-  if (renderer == NULL) {
+  display.renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+  if (display.renderer == NULL) {
     fprintf(stderr, "Renderer creation failed: %s\n", SDL_GetError());
     SDL_DestroyWindow(window);
     SDL_Quit();
     return -1;
   }
 
-  // Create texture for video display
-  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV,
-                              SDL_TEXTUREACCESS_STREAMING, 1280, 720);
-  if (texture == NULL) {
-    fprintf(stderr, "Texture creation failed: %s\n", SDL_GetError());
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
-    return -1;
-  }
+  // The video texture is created from the first decoded frame, see
+  // configureDisplay()
 
-  // Initialize FFmpeg
-  initFFmpeg(filename, &codec_ctx, &frame, &format_ctx, &codec);
+  AVStream *video_stream = ps.format_ctx->streams[ps.video_stream_index];
 
-  // Find correct video stream index again
-  int video_stream_index = -1;
-  for (int i = 0; i < format_ctx->nb_streams; i++) {
-    if (format_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
-        !(format_ctx->streams[i]->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
-      video_stream_index = i;
-      break;
-    }
+  // Audio is optional; without it audio master sync falls back to video
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+    fprintf(stderr, "SDL audio initialization failed: %s\n", SDL_GetError());
+  } else if (openAudioDecoder(&ps) == 0 &&
+             audio_output_open(&ps.audio, ps.audio_ctx, &ps.audio_clock) < 0) {
+    avcodec_free_context(&ps.audio_ctx);
   }
-  if (video_stream_index == -1) {
-    fprintf(stderr, "Could not find video stream\n");
-    return -1;
+  ps.sync_mode = sync_mode;
+  if (ps.sync_mode == SYNC_AUDIO_MASTER && !ps.audio_ctx) {
+    ps.sync_mode = SYNC_VIDEO_MASTER;
   }
-
-  AVStream *video_stream = format_ctx->streams[video_stream_index];
+  fprintf(stderr, "Syncing to the %s clock\n", sync_mode_name(ps.sync_mode));
 
   // Calculate average frame duration as fallback
   double avg_fps = av_q2d(video_stream->avg_frame_rate);
@@ -222,66 +726,164 @@ int main(int argc, char **argv) {
   // Print detected frame rate for debugging
   fprintf(stderr, "Detected average frame rate: %.3f fps, expected frame duration: %.2f ms\n", avg_fps, frame_duration_ms);
 
+  if (packet_queue_init(&ps.video_packets, VIDEO_PACKET_QUEUE_SIZE) < 0 ||
+      frame_ring_init(&ps.video_frames, VIDEO_FRAME_QUEUE_SIZE) < 0 ||
+      (ps.audio_ctx &&
+       packet_queue_init(&ps.audio_packets, AUDIO_PACKET_QUEUE_SIZE) < 0)) {
+    fprintf(stderr, "Could not allocate pipeline queues\n");
+    return -1;
+  }
+
+  ps.frame_event = event_wait_register();
+  if (ps.frame_event == (Uint32)-1 || event_wait_init(&waiter) < 0) {
+    fprintf(stderr, "Could not set up the event loop\n");
+    return -1;
+  }
+
+  // Demux and decode run on their own threads; rendering stays on the main
+  // thread, which owns the window and the renderer
+  demux_tid = SDL_CreateThread(demux_thread, "Demux Thread", &ps);
+  decode_tid = SDL_CreateThread(video_decode_thread, "Decode Thread", &ps);
+  if (ps.audio_ctx) {
+    audio_tid = SDL_CreateThread(audio_decode_thread, "Audio Thread", &ps);
+  }
+  if (!demux_tid || !decode_tid || (ps.audio_ctx && !audio_tid)) {
+    fprintf(stderr, "Thread creation failed: %s\n", SDL_GetError());
+    return -1;
+  }
+  if (ps.audio_ctx) {
+    audio_output_start(&ps.audio);
+  }
+
   // Initialize timing variables
   int64_t last_pts = 0, current_pts = 0;
-  uint32_t start_time = SDL_GetTicks();
-  uint32_t frame_timer = start_time;
+  double frame_timer = frame_pacer_now();
+  uint32_t stats_time = SDL_GetTicks();
 
-  // Main loop for decoding and rendering frames
+  // Render loop: pace and display the decoded frames
   while (isRunning) {
-    if (av_read_frame(format_ctx, &pkt) >= 0) {
-      if (pkt.stream_index == video_stream_index) {  // Correct video stream
-
-        int ret = avcodec_send_packet(codec_ctx, &pkt);
-        if (ret < 0) {
-          fprintf(stderr, "Error sending packet to decoder\n");
-          break;
+    int ret = eof ? AVERROR_EOF : frame_ring_pop(&ps.video_frames, frame, 0);
+    if (ret == AVERROR_EOF && !eof) {
+      eof = 1;
+      fprintf(stderr, "End of stream\n");
+      print_stats(&ps);
+    }
+    if (ret == 0) {
+      current_pts = frame->pts;
+      double pts = frame->best_effort_timestamp == AV_NOPTS_VALUE
+                       ? NAN
+                       : frame->best_effort_timestamp *
+                             av_q2d(video_stream->time_base);
+      double master = media_clock_get(master_clock(&ps));
+      int drop = 0;
+
+      if (ps.sync_mode == SYNC_VIDEO_MASTER || isnan(master) || isnan(pts)) {
+        // Compute delay based on PTS difference if available, kept in
+        // seconds so 59.94 fps does not round to whole milliseconds
+        double delay;
+        if (last_pts != 0 && current_pts > last_pts) {
+          delay = (current_pts - last_pts) * av_q2d(video_stream->time_base);
+        } else {
+          // fallback: use average frame duration
+          delay = frame_duration_ms / 1000.0;
         }
 
-        ret = avcodec_receive_frame(codec_ctx, frame);
-        if (ret == 0) {
-          current_pts = frame->pts;
-
-          // Compute delay based on PTS difference if available
-          int64_t delay_ms;
-          if (last_pts != 0 && current_pts > last_pts) {
-            double pts_diff = (current_pts - last_pts) * av_q2d(video_stream->time_base);
-            delay_ms = (int64_t)(pts_diff * 1000);
-          } else {
-            // fallback: use average frame duration
-            delay_ms = (int64_t)frame_duration_ms;
-          }
-
-          // Update expected next frame time
-          frame_timer += delay_ms;
+        // Update expected next frame time and sleep until it
+        frame_timer += delay;
+        frame_pacer_wait_until(&pacer, frame_timer);
+      } else {
+        // Follow the master clock: wait for early frames, drop frames that
+        // are more than a frame duration late
+        double diff = pts - master;
+        if (diff < -frame_duration_ms / 1000.0) {
+          drop = 1;
+        } else if (diff > 0) {
+          frame_pacer_wait_until(&pacer, frame_pacer_now() +
+                                             FFMIN(diff, AV_SYNC_MAX_WAIT));
+        }
+        frame_timer = frame_pacer_now();
+      }
 
-          // Calculate actual delay needed to sync with real time
-          int64_t actual_delay = frame_timer - SDL_GetTicks();
-          if (actual_delay > 0) {
-            SDL_Delay((Uint32)actual_delay);
+      if (drop) {
+        ps.sync.dropped++;
+      } else {
+        // Render the decoded frame
+        renderFrame(&display, &converter, frame);
+        if (!isnan(pts)) {
+          media_clock_set(&ps.video_clock, pts);
+          if (ps.sync_mode == SYNC_EXTERNAL_CLOCK &&
+              isnan(media_clock_get(&ps.external_clock))) {
+            media_clock_set(&ps.external_clock, pts);
           }
-
-          renderFrame(renderer, texture, frame);  // Render the decoded frame
-          last_pts = current_pts;
+          update_sync_stats(&ps, pts);
         }
       }
-      av_packet_unref(&pkt);
+      last_pts = current_pts;
+      av_frame_unref(frame);
     }
 
-    // Handle SDL events (e.g., quit)
-    while (SDL_PollEvent(&event)) {
+    // Handle SDL events (e.g., quit). Without a frame to show, sleep until
+    // the decoder posts the next one, the stats are due or anything else
+    // happens; once the stream has ended only the events are left
+    int timeout = 0;
+    if (ret != 0) {
+      timeout = -1;
+      if (!eof) {
+        event_wait_until(&timeout, stats_time + STATS_INTERVAL_MS);
+      }
+    }
+    int have_event = event_wait(&waiter, &event, timeout);
+    while (have_event) {
       if (event.type == SDL_QUIT) {
         isRunning = 0;
+      } else if (event.type == SDL_WINDOWEVENT &&
+                 event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+        display.dst_rect_valid = 0;
       }
+      have_event = SDL_PollEvent(&event);
     }
+
+    if (!eof && SDL_GetTicks() - stats_time >= STATS_INTERVAL_MS) {
+      stats_time = SDL_GetTicks();
+      print_stats(&ps);
+    }
+  }
+
+  // Wake up and stop the worker stages
+  packet_queue_abort(&ps.video_packets);
+  frame_ring_abort(&ps.video_frames);
+  if (ps.audio_ctx) {
+    packet_queue_abort(&ps.audio_packets);
+    audio_output_abort(&ps.audio);
+  }
+  SDL_WaitThread(demux_tid, NULL);
+  SDL_WaitThread(decode_tid, NULL);
+  if (audio_tid) {
+    SDL_WaitThread(audio_tid, NULL);
   }
 
+  print_stats(&ps);
+  frame_converter_print_stats(&converter);
+  frame_pacer_print_stats(&pacer);
+  event_wait_print_stats(&waiter, "Render loop");
+  event_wait_close(&waiter);
+
   // Cleanup
+  if (ps.audio_ctx) {
+    audio_output_close(&ps.audio);
+    packet_queue_destroy(&ps.audio_packets);
+    avcodec_free_context(&ps.audio_ctx);
+  }
+  packet_queue_destroy(&ps.video_packets);
+  frame_ring_destroy(&ps.video_frames);
+  frame_converter_free(&converter);
   av_frame_free(&frame);
-  avcodec_free_context(&codec_ctx);
-  avformat_close_input(&format_ctx);
-  SDL_DestroyTexture(texture);
-  SDL_DestroyRenderer(renderer);
+  avcodec_free_context(&ps.codec_ctx);
+  avformat_close_input(&ps.format_ctx);
+  if (display.texture) {
+    SDL_DestroyTexture(display.texture);
+  }
+  SDL_DestroyRenderer(display.renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();
 
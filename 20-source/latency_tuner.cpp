@@ -0,0 +1,158 @@
+#include "latency_tuner.h"
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+
+double latency_tuner_latency_ms(int samples, int freq) {
+  return freq > 0 ? 2000.0 * samples / freq : 0.0;
+}
+
+int latency_tuner_init(LatencyTuner *t, int freq, int samples, int target_ms,
+                       int adaptive) {
+  t->freq = freq;
+  t->target_ms = target_ms;
+  t->adaptive = adaptive;
+  t->last_ticks.store(0);
+  t->warmup.store(LATENCY_TUNER_WARMUP_CALLBACKS);
+  t->callbacks.store(0);
+  t->intervals.store(0);
+  t->jitter_sum_us.store(0);
+  t->window_jitter_max_us.store(0);
+  t->window_start_ms = SDL_GetTicks();
+  t->window_underruns = 0;
+  t->clean_windows = 0;
+  t->shrink_windows = LATENCY_TUNER_SHRINK_WINDOWS;
+  t->jitter_max_us = 0;
+  t->grows = 0;
+  t->shrinks = 0;
+
+  if (adaptive && freq > 0) {
+    samples = LATENCY_TUNER_MIN_SAMPLES;
+    while (samples < LATENCY_TUNER_MAX_SAMPLES &&
+           latency_tuner_latency_ms(samples * 2, freq) <= target_ms) {
+      samples *= 2;
+    }
+  }
+  t->samples = samples;
+  return samples;
+}
+
+void latency_tuner_set_period(LatencyTuner *t, int freq, int samples) {
+  t->freq = freq;
+  t->samples = samples;
+  t->last_ticks.store(0, std::memory_order_relaxed);
+  t->warmup.store(LATENCY_TUNER_WARMUP_CALLBACKS, std::memory_order_relaxed);
+  t->window_jitter_max_us.store(0, std::memory_order_relaxed);
+  t->window_start_ms = SDL_GetTicks();
+  t->clean_windows = 0;
+}
+
+void latency_tuner_on_callback(LatencyTuner *t) {
+  uint64_t now = SDL_GetPerformanceCounter();
+  uint64_t last = t->last_ticks.exchange(now, std::memory_order_relaxed);
+
+  t->callbacks.fetch_add(1, std::memory_order_relaxed);
+  if (!last) {
+    return;
+  }
+  int warmup = t->warmup.load(std::memory_order_relaxed);
+  if (warmup > 0) {
+    t->warmup.store(warmup - 1, std::memory_order_relaxed);
+    return;
+  }
+
+  double interval_us = (double)(now - last) * 1e6 / SDL_GetPerformanceFrequency();
+  double period_us = (double)t->samples * 1e6 / t->freq;
+  double diff = interval_us - period_us;
+  uint64_t jitter_us = (uint64_t)(diff < 0 ? -diff : diff);
+
+  t->intervals.fetch_add(1, std::memory_order_relaxed);
+  t->jitter_sum_us.fetch_add(jitter_us, std::memory_order_relaxed);
+  // The main thread resets the maximum concurrently, a failed exchange
+  // just retries against the fresh value
+  uint64_t cur = t->window_jitter_max_us.load(std::memory_order_relaxed);
+  while (jitter_us > cur &&
+         !t->window_jitter_max_us.compare_exchange_weak(
+             cur, jitter_us, std::memory_order_relaxed)) {
+  }
+}
+
+int latency_tuner_update(LatencyTuner *t, uint64_t underruns) {
+  uint32_t now = SDL_GetTicks();
+  if (now - t->window_start_ms < LATENCY_TUNER_WINDOW_MS) {
+    return 0;
+  }
+
+  uint64_t window_max = t->window_jitter_max_us.exchange(0);
+  uint64_t new_underruns = underruns - t->window_underruns;
+  double period_us = (double)t->samples * 1e6 / t->freq;
+  if (window_max > t->jitter_max_us) {
+    t->jitter_max_us = window_max;
+  }
+  t->window_start_ms = now;
+  t->window_underruns = underruns;
+  if (!t->adaptive) {
+    return 0;
+  }
+
+  // A late callback eats into the period queued ahead of it; past half of
+  // it the next one is likely to miss
+  if (new_underruns > 0 || window_max > period_us / 2) {
+    t->clean_windows = 0;
+    if (t->samples >= LATENCY_TUNER_MAX_SAMPLES) {
+      return 0;
+    }
+    t->grows++;
+    t->shrink_windows *= 2;
+    if (t->shrink_windows > LATENCY_TUNER_MAX_SHRINK_WINDOWS) {
+      t->shrink_windows = LATENCY_TUNER_MAX_SHRINK_WINDOWS;
+    }
+    return t->samples * 2;
+  }
+
+  if (++t->clean_windows < t->shrink_windows ||
+      t->samples <= LATENCY_TUNER_MIN_SAMPLES ||
+      latency_tuner_latency_ms(t->samples, t->freq) <= t->target_ms) {
+    return 0;
+  }
+  t->clean_windows = 0;
+  t->shrinks++;
+  return t->samples / 2;
+}
+
+uint32_t latency_tuner_deadline(LatencyTuner *t) {
+  return t->window_start_ms + LATENCY_TUNER_WINDOW_MS;
+}
+
+LatencyStats latency_tuner_stats(LatencyTuner *t) {
+  LatencyStats st;
+  uint64_t intervals = t->intervals.load(std::memory_order_relaxed);
+  uint64_t window_max = t->window_jitter_max_us.load(std::memory_order_relaxed);
+
+  st.samples = t->samples;
+  st.period_ms = 1000.0 * t->samples / t->freq;
+  st.latency_ms = latency_tuner_latency_ms(t->samples, t->freq);
+  st.target_ms = t->target_ms;
+  st.jitter_avg_ms =
+      intervals ? t->jitter_sum_us.load(std::memory_order_relaxed) / 1000.0 /
+                      intervals
+                : 0.0;
+  st.jitter_max_ms =
+      (window_max > t->jitter_max_us ? window_max : t->jitter_max_us) / 1000.0;
+  st.callbacks = t->callbacks.load(std::memory_order_relaxed);
+  st.grows = t->grows;
+  st.shrinks = t->shrinks;
+  return st;
+}
+
+void latency_tuner_print_stats(LatencyTuner *t) {
+  LatencyStats st = latency_tuner_stats(t);
+
+  fprintf(stderr,
+          "audio latency (%s): %d samples (%.1f ms period), est. output "
+          "latency %.1f ms, target %d ms, jitter avg %.2f ms max %.2f ms, "
+          "%llu callbacks, %d grows, %d shrinks\n",
+          t->adaptive ? "adaptive" : "fixed", st.samples, st.period_ms,
+          st.latency_ms, st.target_ms, st.jitter_avg_ms, st.jitter_max_ms,
+          (unsigned long long)st.callbacks, st.grows, st.shrinks);
+}
@@ -2,16 +2,65 @@
 #include <SDL2/SDL_config.h>
 
 
+#include <atomic>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/cpu.h>
+}
+
+#include "event_wait.h"
+#include "latency_tuner.h"
+#include "pcm_convert.h"
+#include "pcm_mixer.h"
+#include "pcm_stream.h"
 
 static struct {
-  SDL_AudioSpec spec;
-  Uint8* sound;    /* Pointer to wave data*/
-  Uint32 soundLen; /* Length of wave data*/
-  int soundpos;    /* Current play position*/
+  SDL_AudioSpec spec;        /* What the file holds, and what we ask for*/
+  SDL_AudioSpec device_spec; /* What the device was opened with*/
+  int allowed_changes;       /* SDL_AUDIO_ALLOW_* for the next open*/
+  PcmConvert convert[PCM_MIXER_MAX_STREAMS]; /* File -> device format, per reader thread*/
+  PcmStream stream[PCM_MIXER_MAX_STREAMS];   /* Rings the reader threads fill from the files*/
+  int nb_streams;
+  int mixing;                /* More than one file or a --gain: sum them in the callback*/
+  PcmMixer mixer;
+  LatencyTuner tuner;        /* Callback timing, picks the device period*/
+  std::atomic<int> active;   /* Slot (callback userdata) allowed to read the rings*/
 } wave;
 
 static SDL_AudioDeviceID device;
+static char* device_name;          /* what device was opened as, NULL for the default */
+static const char* wanted_device;  /* --device */
+
+/* Device switches (hot-plug, a new period) run on a worker thread so the
+ * old device keeps playing meanwhile: the new one is opened and started
+ * first, playing silence, then the active slot flips while the old device
+ * is locked. The rings are only ever read by one device and keep their
+ * position. Drivers that can't have two outputs open (dummy, disk) get the
+ * old device closed first, which leaves a gap. */
+static struct {
+  SDL_Thread* thread;
+  Uint32 done_event;     /* pushed by the worker when it is finished*/
+  int recheck;           /* device list changed while switching*/
+  /* request, main thread -> worker */
+  char* name;            /* NULL for the default device*/
+  int samples;
+  SDL_AudioDeviceID old;
+  Uint64 requested;      /* performance counter at the request*/
+  /* result, worker -> main thread */
+  SDL_AudioDeviceID id;  /* 0 if the open failed*/
+  SDL_AudioSpec spec;
+  int gap;
+  double latency_ms;     /* request to cutover*/
+  /* totals */
+  int swaps;
+  int gaps;
+  int failures;
+  double latency_sum_ms;
+  double latency_max_ms;
+} swap;
 
 static void quit(int rc) {
   SDL_Quit();
@@ -25,37 +74,140 @@ static void close_audio(void) {
   }
 }
 
+/* opened paused, start_audio() once the ring has data */
 static void open_audio(void) {
-  device = SDL_OpenAudioDevice(NULL, SDL_FALSE, &wave.spec, NULL, 0);
+  device = SDL_OpenAudioDevice(NULL, SDL_FALSE, &wave.spec, &wave.device_spec,
+                               wave.allowed_changes);
   if (!device) {
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't opne audio: %s\n",
                  SDL_GetError());
-    SDL_FreeWAV(wave.sound);
     quit(2);
   }
+}
+
+static void start_audio(void) {
   SDL_PauseAudioDevice(device,SDL_FALSE);
 }
 
-void SDLCALL fillerup(void* unused, Uint8* stream, int len)
+/* Take whatever format/channels the device prefers and convert to it
+ * ourselves; only when it wants something we have no kernel for (or, when
+ * mixing, something other than s16/f32), reopen with the file format and
+ * leave the conversion to SDL. The period stays ours to pick, see
+ * LatencyTuner */
+static void negotiate_audio(int native)
+{
+    wave.allowed_changes = native ? SDL_AUDIO_ALLOW_FORMAT_CHANGE |
+                                    SDL_AUDIO_ALLOW_CHANNELS_CHANGE : 0;
+    open_audio();
+
+    const char* path;
+    if (pcm_convert_init(&wave.convert[0], wave.spec.channels, &wave.device_spec,
+                         av_get_cpu_flags()) < 0 ||
+        (wave.mixing && pcm_mixer_init(&wave.mixer, wave.device_spec.format,
+                                       wave.device_spec.channels,
+                                       av_get_cpu_flags()) < 0)) {
+        SDL_Log("No %s for device format %s, SDL will convert",
+                wave.mixing ? "converter or mixer" : "converter",
+                pcm_convert_format_name(wave.device_spec.format));
+        close_audio();
+        wave.allowed_changes = 0;
+        open_audio();
+        pcm_convert_init(&wave.convert[0], wave.spec.channels, &wave.device_spec, 0);
+        if (wave.mixing && pcm_mixer_init(&wave.mixer, wave.device_spec.format,
+                                          wave.device_spec.channels,
+                                          av_get_cpu_flags()) < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Can't mix %s\n",
+                         pcm_convert_format_name(wave.device_spec.format));
+            quit(2);
+        }
+        path = "SDL converts in its audio thread";
+    } else if (pcm_convert_is_passthrough(&wave.convert[0])) {
+        path = native ? "device takes the file format, no conversion"
+                      : "SDL converts in its audio thread if the device differs";
+    } else {
+        path = "converted on the reader thread";
+    }
+
+    SDL_Log("Device: %s, %d ch, %d Hz, %d samples per callback",
+            pcm_convert_format_name(wave.device_spec.format),
+            wave.device_spec.channels, wave.device_spec.freq,
+            wave.device_spec.samples);
+    SDL_Log("Conversion: s16 %d ch -> %s %d ch, %s (%s)", wave.spec.channels,
+            pcm_convert_format_name(wave.device_spec.format),
+            wave.device_spec.channels, path,
+            pcm_convert_is_passthrough(&wave.convert[0]) ? "none" : wave.convert[0].kernel);
+    if (wave.mixing) {
+        SDL_Log("Mixing %d streams in the callback (%s)", wave.nb_streams,
+                wave.mixer.kernels.name);
+    }
+
+    /* nothing is allocated before the first run, so every reader thread
+     * can take a copy and grow its own remix buffer */
+    for (int i = 1; i < wave.nb_streams; i++) {
+        wave.convert[i] = wave.convert[0];
+    }
+
+    /* a later reopen must match what the ring already holds */
+    wave.spec.format = wave.device_spec.format;
+    wave.spec.channels = wave.device_spec.channels;
+    wave.spec.samples = wave.device_spec.samples;
+    wave.allowed_changes = 0;
+}
+
+void SDLCALL fillerup(void* userdata, Uint8* stream, int len)
+{
+    /* a device being switched to or away from only plays silence */
+    if ((int)(intptr_t)userdata != wave.active.load(std::memory_order_acquire)) {
+        SDL_memset(stream, wave.stream[0].silence, len);
+        return;
+    }
+    latency_tuner_on_callback(&wave.tuner);
+    /* never waits for the disk, a late reader shows up as an underrun */
+    if (wave.mixing) {
+        pcm_mixer_mix(&wave.mixer, stream, len);
+    } else {
+        pcm_stream_read(&wave.stream[0], stream, len);
+    }
+}
+
+static int all_finished(void)
 {
-    Uint8* waveptr;
-    int waveleft;
+    for (int i = 0; i < wave.nb_streams; i++) {
+        if (!pcm_stream_finished(&wave.stream[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
 
-    /* set up the pointers */
-    waveptr = wave.sound + wave.soundpos;
-    waveleft = wave.soundLen - wave.soundpos;
+/* once every reader is done: until the fullest ring has played out */
+static int drain_ms(void)
+{
+    unsigned fill = 0;
+    for (int i = 0; i < wave.nb_streams; i++) {
+        unsigned f = audio_ring_fill(&wave.stream[i].ring);
+        if (f > fill) {
+            fill = f;
+        }
+    }
+    int bytes_per_ms = wave.device_spec.freq * wave.stream[0].frame_bytes / 1000;
+    return (int)(fill / (bytes_per_ms > 0 ? bytes_per_ms : 1)) +
+           1000 * wave.device_spec.samples / wave.device_spec.freq + 1;
+}
 
-    /* Go ! */
-    while (waveleft <= len) {
-        SDL_memcpy(stream, waveptr, waveleft);
-        stream += waveleft;
-        len -= waveleft;
-        waveptr = wave.sound;
-        waveleft = wave.soundLen;
-        wave.soundpos = 0;
+/* underruns summed over the streams, the lowest fill any of them saw */
+static AudioRingStats ring_totals(void)
+{
+    AudioRingStats total = audio_ring_stats(&wave.stream[0].ring);
+    for (int i = 1; i < wave.nb_streams; i++) {
+        AudioRingStats st = audio_ring_stats(&wave.stream[i].ring);
+        total.underruns += st.underruns;
+        total.underrun_bytes += st.underrun_bytes;
+        if (st.min_fill < total.min_fill) {
+            total.min_fill = st.min_fill;
+        }
     }
-    SDL_memcpy(stream, waveptr, len);
-    wave.soundpos += len;
+    return total;
 }
 
 static int done = 0;
@@ -116,41 +268,170 @@ char* GetResourceFilename (const char* user_specified, const char* def)
 
 
 
-static void reopen_audio(void)
+static double ms_since(Uint64 ticks)
 {
-    close_audio();
-    open_audio();
+    return (SDL_GetPerformanceCounter() - ticks) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+/* dummy and disk only ever have one output, a second open fails while the
+ * old device is still open */
+static int single_output_driver(void)
+{
+    const char* driver = SDL_GetCurrentAudioDriver();
+    return driver && (!SDL_strcmp(driver, "dummy") || !SDL_strcmp(driver, "disk"));
+}
+
+static int SDLCALL swap_thread(void* data)
+{
+    int slot = !wave.active.load(std::memory_order_relaxed);
+    SDL_AudioDeviceID old = swap.old;
+    SDL_AudioSpec want = wave.spec;
+
+    (void)data;
+    want.samples = swap.samples;
+    want.userdata = (void*)(intptr_t)slot;
+    swap.gap = 0;
+    /* same format as the rings hold, SDL converts if the new device differs */
+    swap.id = SDL_OpenAudioDevice(swap.name, SDL_FALSE, &want, &swap.spec, 0);
+    /* any other failure (rejected period, missing --device) keeps the old
+     * device playing, finish_swap falls back to it */
+    if (!swap.id && old && single_output_driver()) {
+        swap.gap = 1;
+        SDL_CloseAudioDevice(old);
+        old = 0;
+        swap.id = SDL_OpenAudioDevice(swap.name, SDL_FALSE, &want, &swap.spec, 0);
+    }
+    swap.old = old;
+    if (!swap.id) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't open %s: %s\n",
+                     swap.name ? swap.name : "the default device", SDL_GetError());
+        event_wait_post(swap.done_event, 0);
+        return -1;
+    }
+
+    SDL_PauseAudioDevice(swap.id, SDL_FALSE);
+    /* the old device's callback can't be halfway through a ring read */
+    if (old) {
+        SDL_LockAudioDevice(old);
+    }
+    latency_tuner_set_period(&wave.tuner, swap.spec.freq, swap.spec.samples);
+    wave.active.store(slot, std::memory_order_release);
+    if (old) {
+        SDL_UnlockAudioDevice(old);
+    }
+    swap.latency_ms = ms_since(swap.requested);
+
+    /* slow on some drivers, nothing waits for it any more */
+    if (old) {
+        SDL_CloseAudioDevice(old);
+    }
+    event_wait_post(swap.done_event, 0);
+    return 0;
 }
 
-SDL_AudioSpec* SDL_LoadPWC(SDL_RWops* src, int freesrc, SDL_AudioSpec* spec, Uint8 ** audio_buf, Uint32 *audio_len)
+static void start_swap(const char* name, int samples, const char* why)
 {
-    int result;
-    
+    if (swap.thread) {
+        swap.recheck = 1;
+        return;
+    }
+    SDL_free(swap.name);
+    swap.name = name ? SDL_strdup(name) : NULL;
+    swap.samples = samples;
+    swap.old = device;
+    swap.requested = SDL_GetPerformanceCounter();
+    SDL_Log("Switching to %s (%s)", name ? name : "the default device", why);
+    swap.thread = SDL_CreateThread(swap_thread, "audio swap", NULL);
+    if (!swap.thread) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't start the switch: %s\n",
+                     SDL_GetError());
+        swap.failures++;
+    }
+}
 
-    SDL_zero(file);
+/* main thread, once the worker is done: take over what it opened */
+static void finish_swap(void)
+{
+    if (!swap.thread) {
+        return;
+    }
+    SDL_WaitThread(swap.thread, NULL);
+    swap.thread = NULL;
+    if (!swap.id) {
+        device = swap.old;
+        swap.failures++;
+        return;
+    }
 
-    if (!src) {
-        /** Error may come from rwops */
-        return NULL;
-    } else if (!spec) {
-        SDL_InvalidParamError("spec");
-        return NULL;
-    } else if (!audio_buf) {
-        SDL_InvalidParamError("audio_buf");
-        return NULL;
-    } else if (!audio_len) {
-        SDL_InvalidParamError("audio_len");
-        return NULL;
+    device = swap.id;
+    wave.device_spec = swap.spec;
+    wave.spec.samples = swap.spec.samples;
+    SDL_free(device_name);
+    device_name = swap.name;
+    swap.name = NULL;
+    swap.swaps++;
+    swap.gaps += swap.gap;
+    swap.latency_sum_ms += swap.latency_ms;
+    if (swap.latency_ms > swap.latency_max_ms) {
+        swap.latency_max_ms = swap.latency_ms;
     }
+    SDL_Log("Now on %s, %d samples per callback, reopen latency %.1f ms%s",
+            device_name ? device_name : "the default device", wave.device_spec.samples,
+            swap.latency_ms, swap.gap ? " (closed the old device first)" : "");
+}
+
+/* Move to --device when it shows up, or to anything at all when the
+ * current device is gone; any other device coming or going is ignored */
+static void pick_device(int lost)
+{
+    int on_wanted = device && device_name && wanted_device &&
+                    !strcmp(device_name, wanted_device);
 
-    *audio_buf = NULL;
-    *audio_len = 0;
+    if (swap.thread) {
+        swap.recheck = 1;
+        return;
+    }
+    if (device && SDL_GetAudioDeviceStatus(device) == SDL_AUDIO_STOPPED) {
+        lost = 1;
+    }
+    if (wanted_device && (lost || !on_wanted)) {
+        for (int i = 0; i < SDL_GetNumAudioDevices(SDL_FALSE); i++) {
+            const char* name = SDL_GetAudioDeviceName(i, SDL_FALSE);
+            if (name && !strcmp(name, wanted_device)) {
+                start_swap(name, wave.spec.samples,
+                           lost ? "device removed" : "wanted device added");
+                return;
+            }
+        }
+    }
+    if (lost || !device) {
+        start_swap(NULL, wave.spec.samples, lost ? "device removed" : "no device");
+    }
 }
 
 int main (int argc, char* argv[])
 {
     int i;
-    char* filename = NULL;
+    char* filenames[PCM_MIXER_MAX_STREAMS];
+    const char* user_files[PCM_MIXER_MAX_STREAMS];
+    float gains[PCM_MIXER_MAX_STREAMS];
+    float gain = 1.0f;
+    EsReaderMode read_mode = ES_READER_MMAP;
+    int ring_size = 0;
+    int loop = 1;
+    int native = 1;
+    int rate = 44100;
+    int channels = 2;
+    int samples = 4096;
+    int low_latency = 0;
+    int target_ms = 20;
+    int seconds = 0;
+    int hotplug_ms = 0;
+    int hotplug_added = 0;
+    int readers_done = 0;
+    Uint32 eof_event;
+    EventWait waiter;
+    Uint64 last_underruns = 0;
     SDL_setenv("SDL_AUDIODRIVER", "alsa", 0);
 
     /* Enable standard application logging */
@@ -164,17 +445,79 @@ int main (int argc, char* argv[])
     }
 
 
-    filename = GetResourceFilename(argc > 1 ? argv[1] : NULL, "sample.wav");
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--ring-kb") && i + 1 < argc) {
+            ring_size = atoi(argv[++i]) << 10;
+        } else if (!strcmp(argv[i], "--once")) {
+            loop = 0;
+        } else if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+            rate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--channels") && i + 1 < argc) {
+            channels = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--sdl-convert")) {
+            native = 0;
+        } else if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+            samples = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--low-latency")) {
+            low_latency = 1;
+        } else if (!strcmp(argv[i], "--target-ms") && i + 1 < argc) {
+            target_ms = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            seconds = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--device") && i + 1 < argc) {
+            wanted_device = argv[++i];
+        } else if (!strcmp(argv[i], "--hotplug-test") && i + 1 < argc) {
+            /* synthetic remove/add events, e.g. with SDL_AUDIODRIVER=dummy */
+            hotplug_ms = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--gain") && i + 1 < argc) {
+            /* applies to the files after it */
+            gain = (float)atof(argv[++i]);
+            wave.mixing = 1;
+        } else if (es_reader_parse_mode(argv[i], &read_mode) == 0) {
+            continue;
+        } else if (argv[i][0] != '-' && wave.nb_streams < PCM_MIXER_MAX_STREAMS) {
+            gains[wave.nb_streams] = gain;
+            user_files[wave.nb_streams++] = argv[i];
+        } else {
+            SDL_Log("Usage: %s [[--gain g] file...] [read|mmap] [--ring-kb N] [--once] "
+                    "[--rate hz] [--channels n] [--sdl-convert] [--samples n] "
+                    "[--low-latency [--target-ms ms]] [--seconds n] [--device name] "
+                    "[--hotplug-test ms]", argv[0]);
+            quit(1);
+        }
+    }
+
+    if (wave.nb_streams == 0) {
+        gains[0] = gain;
+        user_files[wave.nb_streams++] = NULL;
+    }
+    if (wave.nb_streams > 1) {
+        wave.mixing = 1;
+    }
+    for (i = 0; i < wave.nb_streams; i++) {
+        filenames[i] = GetResourceFilename(user_files[i], "sample.wav");
+        if (!filenames[i]) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s\n", SDL_GetError());
+            quit(1);
+        }
+    }
 
-    if (!filename) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s\n", SDL_GetError());
+    if (rate <= 0 || channels <= 0 || channels * 2 > PCM_STREAM_MAX_FRAME ||
+        samples <= 0 || samples > 65535 || target_ms <= 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Invalid --rate, --channels, "
+                     "--samples or --target-ms\n");
         quit(1);
     }
 
-    wave.spec.userdata = nullptr;
+    /* low-latency mode starts at the period the target allows and adapts */
+    samples = latency_tuner_init(&wave.tuner, rate, samples, target_ms, low_latency);
+
+    /* the file is raw s16le, the device may ask for something else */
+    wave.spec.userdata = (void*)(intptr_t)0; /* slot 0 is active, see swap_thread*/
+    wave.spec.freq = rate;
     wave.spec.format = AUDIO_S16LSB;
-    wave.spec.channels = 2;
-    wave.spec.samples = 4096;
+    wave.spec.channels = channels;
+    wave.spec.samples = samples;
 
     wave.spec.callback = fillerup;
 
@@ -186,27 +529,132 @@ int main (int argc, char* argv[])
 
     SDL_Log("Using audio driver: %s\n", SDL_GetCurrentAudioDriver());
 
-    open_audio();
+    /* the main loop sleeps until one of the worker threads posts these */
+    swap.done_event = event_wait_register();
+    eof_event = event_wait_register();
+    if (swap.done_event == (Uint32)-1 || eof_event == (Uint32)-1 ||
+        event_wait_init(&waiter) < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't set up the event loop\n");
+        quit(1);
+    }
+    negotiate_audio(native);
+    latency_tuner_set_period(&wave.tuner, wave.device_spec.freq,
+                             wave.device_spec.samples);
+
+    /* stream from disk instead of loading the file, memory stays at the ring size */
+    for (i = 0; i < wave.nb_streams; i++) {
+        if (pcm_stream_open(&wave.stream[i], filenames[i], read_mode, ring_size,
+                            wave.convert[i].dst_frame_bytes, &wave.convert[i],
+                            wave.device_spec.silence, loop, eof_event) < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't open %s\n", filenames[i]);
+            quit(1);
+        }
+        /* the reader sleeps while its ring is full instead of polling it */
+        audio_ring_set_rate(&wave.stream[i].ring,
+                            wave.device_spec.freq * wave.convert[i].dst_frame_bytes);
+        if (wave.mixing) {
+            pcm_mixer_add(&wave.mixer, &wave.stream[i].ring, gains[i]);
+        }
+    }
+
+    start_audio();
 
     SDL_FlushEvents(SDL_AUDIODEVICEADDED, SDL_AUDIODEVICEREMOVED);
 
+    Uint32 start_ticks = SDL_GetTicks();
+    Uint32 hotplug_ticks = start_ticks;
     while (!done) {
         SDL_Event event;
-        while (SDL_PollEvent(&event) > 0) {
+        /* sleep until an event or whatever is due next: the tuner window,
+         * --seconds, the hot-plug test, the last bytes playing out */
+        int timeout = -1;
+        if (device && !swap.thread) {
+            event_wait_until(&timeout, latency_tuner_deadline(&wave.tuner));
+        }
+        if (seconds > 0) {
+            event_wait_until(&timeout, start_ticks + (Uint32)seconds * 1000);
+        }
+        if (hotplug_ms > 0) {
+            event_wait_until(&timeout, hotplug_ticks + (Uint32)hotplug_ms);
+        }
+        if (readers_done == wave.nb_streams) {
+            event_wait_until(&timeout, SDL_GetTicks() + drain_ms());
+        }
+        int have_event = event_wait(&waiter, &event, timeout);
+        for (; have_event; have_event = SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 done = 1;
-            }
-            if ((event.type == SDL_AUDIODEVICEADDED && !event.adevice.iscapture) || 
-                (event.type == SDL_AUDIODEVICEREMOVED && !event.adevice.iscapture && event.adevice.which == device)) {
-                    reopen_audio();
+            } else if (event.type == SDL_AUDIODEVICEADDED && !event.adevice.iscapture) {
+                const char* name = SDL_GetAudioDeviceName(event.adevice.which, SDL_FALSE);
+                SDL_Log("Audio device added: %s", name ? name : "?");
+                pick_device(0);
+            } else if (event.type == SDL_AUDIODEVICEREMOVED && !event.adevice.iscapture &&
+                       event.adevice.which == device) {
+                pick_device(1);
+            } else if (event.type == swap.done_event) {
+                finish_swap();
+                if (swap.recheck) {
+                    swap.recheck = 0;
+                    pick_device(0);
                 }
+            } else if (event.type == eof_event) {
+                readers_done++;
+            }
+        }
+        if (hotplug_ms > 0 && SDL_GetTicks() - hotplug_ticks >= (Uint32)hotplug_ms) {
+            SDL_zero(event);
+            event.type = hotplug_added ? SDL_AUDIODEVICEREMOVED : SDL_AUDIODEVICEADDED;
+            event.adevice.which = hotplug_added ? device : 0;
+            SDL_PushEvent(&event);
+            hotplug_added = !hotplug_added;
+            hotplug_ticks = SDL_GetTicks();
+        }
+        if (all_finished()) {
+            done = 1;
+        }
+        if (seconds > 0 && SDL_GetTicks() - start_ticks >= (Uint32)seconds * 1000) {
+            done = 1;
+        }
+        AudioRingStats st = ring_totals();
+        if (st.underruns != last_underruns) {
+            SDL_Log("underruns: %llu (%llu bytes of silence), ring low %u KB",
+                    (unsigned long long)st.underruns,
+                    (unsigned long long)st.underrun_bytes, st.min_fill >> 10);
+            last_underruns = st.underruns;
+        }
+
+        /* a new period needs a reopen; the rings keep the position. The
+         * worker owns the tuner's period while it switches */
+        int new_samples = swap.thread || !device ? 0 :
+                          latency_tuner_update(&wave.tuner, st.underruns);
+        if (new_samples) {
+            LatencyStats ls = latency_tuner_stats(&wave.tuner);
+            SDL_Log("period %d -> %d samples (jitter max %.2f ms), est. latency %.1f ms",
+                    ls.samples, new_samples, ls.jitter_max_ms,
+                    latency_tuner_latency_ms(new_samples, wave.device_spec.freq));
+            start_swap(device_name, new_samples, "new period");
         }
-        SDL_Delay(100);
     }
 
+    finish_swap();
     close_audio();
-    SDL_FreeWAV(wave.sound);
-    SDL_free(filename);
+    SDL_Log("device switches: %d (%d with a gap, %d failed), reopen latency avg %.1f ms "
+            "max %.1f ms", swap.swaps, swap.gaps, swap.failures,
+            swap.swaps ? swap.latency_sum_ms / swap.swaps : 0.0, swap.latency_max_ms);
+    SDL_free(device_name);
+    SDL_free(swap.name);
+    event_wait_print_stats(&waiter, "main loop");
+    event_wait_close(&waiter);
+    latency_tuner_print_stats(&wave.tuner);
+    if (wave.mixing) {
+        pcm_mixer_print_stats(&wave.mixer);
+    }
+    for (i = 0; i < wave.nb_streams; i++) {
+        pcm_stream_print_stats(&wave.stream[i]);
+        pcm_stream_close(&wave.stream[i]);
+        pcm_convert_free(&wave.convert[i]);
+        SDL_free(filenames[i]);
+    }
     SDL_Quit();
     return 0;
 }
@@ -0,0 +1,37 @@
+#include "media_clock.h"
+
+extern "C" {
+#include <libavutil/time.h>
+}
+#include <math.h>
+
+double media_clock_now(void) { return av_gettime_relative() / 1000000.0; }
+
+void media_clock_init(MediaClock *c) {
+  c->pts = NAN;
+  c->last_updated = media_clock_now();
+  c->lock = 0;
+}
+
+void media_clock_set(MediaClock *c, double pts) {
+  media_clock_set_at(c, pts, media_clock_now());
+}
+
+void media_clock_set_at(MediaClock *c, double pts, double time) {
+  SDL_AtomicLock(&c->lock);
+  c->pts = pts;
+  c->last_updated = time;
+  SDL_AtomicUnlock(&c->lock);
+}
+
+double media_clock_get(MediaClock *c) {
+  SDL_AtomicLock(&c->lock);
+  double pts = c->pts;
+  double last_updated = c->last_updated;
+  SDL_AtomicUnlock(&c->lock);
+
+  if (isnan(pts)) {
+    return NAN;
+  }
+  return pts + media_clock_now() - last_updated;
+}
@@ -0,0 +1,344 @@
+#include "pcm_convert.h"
+
+extern "C" {
+#include <libavutil/cpu.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+#include <string.h>
+
+#include "simd_dispatch.h"
+
+#define S16_TO_F32_SCALE (1.0f / 32768.0f)
+
+static void to_f32_tail(uint8_t *dst, const int16_t *src, int start,
+                        int count) {
+  float *out = (float *)dst;
+  for (int i = start; i < count; i++) {
+    out[i] = src[i] * S16_TO_F32_SCALE;
+  }
+}
+
+static void to_s32_tail(uint8_t *dst, const int16_t *src, int start,
+                        int count) {
+  int32_t *out = (int32_t *)dst;
+  for (int i = start; i < count; i++) {
+    out[i] = (int32_t)((uint32_t)(uint16_t)src[i] << 16);
+  }
+}
+
+static void to_s8_tail(uint8_t *dst, const int16_t *src, int start,
+                       int count) {
+  for (int i = start; i < count; i++) {
+    dst[i] = (uint8_t)(src[i] >> 8);
+  }
+}
+
+static void to_u8_tail(uint8_t *dst, const int16_t *src, int start,
+                       int count) {
+  for (int i = start; i < count; i++) {
+    dst[i] = (uint8_t)((src[i] >> 8) + 128);
+  }
+}
+
+static void to_f32_c(uint8_t *dst, const int16_t *src, int count) {
+  to_f32_tail(dst, src, 0, count);
+}
+
+static void to_s32_c(uint8_t *dst, const int16_t *src, int count) {
+  to_s32_tail(dst, src, 0, count);
+}
+
+static void to_s8_c(uint8_t *dst, const int16_t *src, int count) {
+  to_s8_tail(dst, src, 0, count);
+}
+
+static void to_u8_c(uint8_t *dst, const int16_t *src, int count) {
+  to_u8_tail(dst, src, 0, count);
+}
+
+#if SIMD_X86
+// Unpacking a sample with itself and shifting back sign-extends it to 32
+// bits; unpacking it above zero is the s32 value directly
+static void to_f32_sse2(uint8_t *dst, const int16_t *src, int count) {
+  const __m128 scale = _mm_set1_ps(S16_TO_F32_SCALE);
+  float *out = (float *)dst;
+  int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+  }
+  to_f32_tail(dst, src, i, count);
+}
+
+static void to_s32_sse2(uint8_t *dst, const int16_t *src, int count) {
+  const __m128i zero = _mm_setzero_si128();
+  int32_t *out = (int32_t *)dst;
+  int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi16(zero, x));
+    _mm_storeu_si128((__m128i *)(out + i + 4), _mm_unpackhi_epi16(zero, x));
+  }
+  to_s32_tail(dst, src, i, count);
+}
+
+// High byte of each sample, packed with signed saturation (which never
+// triggers after the shift); u8 flips the sign bit on top
+static inline __m128i high_bytes_sse2(const int16_t *src) {
+  __m128i a = _mm_srai_epi16(_mm_loadu_si128((const __m128i *)src), 8);
+  __m128i b = _mm_srai_epi16(_mm_loadu_si128((const __m128i *)(src + 8)), 8);
+  return _mm_packs_epi16(a, b);
+}
+
+static void to_s8_sse2(uint8_t *dst, const int16_t *src, int count) {
+  int i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    _mm_storeu_si128((__m128i *)(dst + i), high_bytes_sse2(src + i));
+  }
+  to_s8_tail(dst, src, i, count);
+}
+
+static void to_u8_sse2(uint8_t *dst, const int16_t *src, int count) {
+  const __m128i sign = _mm_set1_epi8((char)0x80);
+  int i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_xor_si128(high_bytes_sse2(src + i), sign));
+  }
+  to_u8_tail(dst, src, i, count);
+}
+#endif
+
+#if SIMD_TARGETS
+TARGET_AVX2 static void to_f32_avx2(uint8_t *dst, const int16_t *src,
+                                    int count) {
+  const __m256 scale = _mm256_set1_ps(S16_TO_F32_SCALE);
+  float *out = (float *)dst;
+  int i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    __m256i lo = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128((const __m128i *)(src + i)));
+    __m256i hi = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128((const __m128i *)(src + i + 8)));
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+    _mm256_storeu_ps(out + i + 8,
+                     _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+  }
+  to_f32_tail(dst, src, i, count);
+}
+
+TARGET_AVX2 static void to_s32_avx2(uint8_t *dst, const int16_t *src,
+                                    int count) {
+  int32_t *out = (int32_t *)dst;
+  int i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    __m256i lo = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128((const __m128i *)(src + i)));
+    __m256i hi = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128((const __m128i *)(src + i + 8)));
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_slli_epi32(lo, 16));
+    _mm256_storeu_si256((__m256i *)(out + i + 8), _mm256_slli_epi32(hi, 16));
+  }
+  to_s32_tail(dst, src, i, count);
+}
+
+// The 256-bit pack works per 128-bit lane, so the 64-bit quarters are put
+// back in order afterwards
+TARGET_AVX2 static inline __m256i high_bytes_avx2(const int16_t *src) {
+  __m256i a = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i *)src), 8);
+  __m256i b =
+      _mm256_srai_epi16(_mm256_loadu_si256((const __m256i *)(src + 16)), 8);
+  return _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+}
+
+TARGET_AVX2 static void to_s8_avx2(uint8_t *dst, const int16_t *src,
+                                   int count) {
+  int i = 0;
+
+  for (; i + 32 <= count; i += 32) {
+    _mm256_storeu_si256((__m256i *)(dst + i), high_bytes_avx2(src + i));
+  }
+  to_s8_tail(dst, src, i, count);
+}
+
+TARGET_AVX2 static void to_u8_avx2(uint8_t *dst, const int16_t *src,
+                                   int count) {
+  const __m256i sign = _mm256_set1_epi8((char)0x80);
+  int i = 0;
+
+  for (; i + 32 <= count; i += 32) {
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        _mm256_xor_si256(high_bytes_avx2(src + i), sign));
+  }
+  to_u8_tail(dst, src, i, count);
+}
+#endif
+
+PcmConvertFunc pcm_convert_get(SDL_AudioFormat format, int cpu_flags,
+                               const char **name) {
+  PcmConvertFunc c_func, sse2_func = NULL, avx2_func = NULL;
+  PcmConvertFunc func;
+  const char *func_name = "c";
+
+  switch (format) {
+    case AUDIO_F32SYS:
+      c_func = to_f32_c;
+#if SIMD_X86
+      sse2_func = to_f32_sse2;
+#endif
+#if SIMD_TARGETS
+      avx2_func = to_f32_avx2;
+#endif
+      break;
+    case AUDIO_S32SYS:
+      c_func = to_s32_c;
+#if SIMD_X86
+      sse2_func = to_s32_sse2;
+#endif
+#if SIMD_TARGETS
+      avx2_func = to_s32_avx2;
+#endif
+      break;
+    case AUDIO_S8:
+      c_func = to_s8_c;
+#if SIMD_X86
+      sse2_func = to_s8_sse2;
+#endif
+#if SIMD_TARGETS
+      avx2_func = to_s8_avx2;
+#endif
+      break;
+    case AUDIO_U8:
+      c_func = to_u8_c;
+#if SIMD_X86
+      sse2_func = to_u8_sse2;
+#endif
+#if SIMD_TARGETS
+      avx2_func = to_u8_avx2;
+#endif
+      break;
+    default:
+      return NULL;
+  }
+
+  func = c_func;
+#if SIMD_X86
+  if (sse2_func && (cpu_flags & AV_CPU_FLAG_SSE2)) {
+    func = sse2_func;
+    func_name = "sse2";
+  }
+#endif
+#if SIMD_TARGETS
+  if (avx2_func && (cpu_flags & AV_CPU_FLAG_AVX2)) {
+    func = avx2_func;
+    func_name = "avx2";
+  }
+#endif
+  if (name) {
+    *name = func_name;
+  }
+  return func;
+}
+
+int pcm_convert_init(PcmConvert *c, int src_channels,
+                     const SDL_AudioSpec *device, int cpu_flags) {
+  memset(c, 0, sizeof(*c));
+  c->src_channels = src_channels;
+  c->dst_channels = device->channels;
+  c->dst_format = device->format;
+  c->src_frame_bytes = src_channels * 2;
+  c->dst_frame_bytes = device->channels * SDL_AUDIO_BITSIZE(device->format) / 8;
+  c->kernel = "c";
+
+  if (device->format == AUDIO_S16SYS) {
+    return 0;
+  }
+  c->convert = pcm_convert_get(device->format, cpu_flags, &c->kernel);
+  return c->convert ? 0 : AVERROR(ENOSYS);
+}
+
+// Channel mapping in the s16 domain: stereo and up fold down to mono,
+// mono goes to the front pair, any other pair keeps the channels both
+// sides have and leaves the rest silent
+static void remix(int16_t *dst, int dst_channels, const int16_t *src,
+                  int src_channels, int nb_frames) {
+  for (int i = 0; i < nb_frames; i++) {
+    const int16_t *in = src + (size_t)i * src_channels;
+    int16_t *out = dst + (size_t)i * dst_channels;
+
+    if (dst_channels == 1) {
+      out[0] = src_channels >= 2 ? (int16_t)((in[0] + in[1]) >> 1) : in[0];
+      continue;
+    }
+    for (int ch = 0; ch < dst_channels; ch++) {
+      if (src_channels == 1) {
+        out[ch] = ch < 2 ? in[0] : 0;
+      } else {
+        out[ch] = ch < src_channels ? in[ch] : 0;
+      }
+    }
+  }
+}
+
+int pcm_convert_run(PcmConvert *c, uint8_t *dst, const uint8_t *src,
+                    int nb_frames) {
+  const int16_t *samples = (const int16_t *)src;
+
+  if (c->src_channels != c->dst_channels) {
+    if (!c->convert) {
+      remix((int16_t *)dst, c->dst_channels, samples, c->src_channels,
+            nb_frames);
+      return 0;
+    }
+    av_fast_malloc(&c->remix_buf, &c->remix_buf_size,
+                   (size_t)nb_frames * c->dst_channels * sizeof(int16_t));
+    if (!c->remix_buf) {
+      return AVERROR(ENOMEM);
+    }
+    remix(c->remix_buf, c->dst_channels, samples, c->src_channels, nb_frames);
+    samples = c->remix_buf;
+  }
+
+  if (c->convert) {
+    c->convert(dst, samples, nb_frames * c->dst_channels);
+  } else {
+    memcpy(dst, src, (size_t)nb_frames * c->src_frame_bytes);
+  }
+  return 0;
+}
+
+int pcm_convert_is_passthrough(const PcmConvert *c) {
+  return !c->convert && c->src_channels == c->dst_channels;
+}
+
+const char *pcm_convert_format_name(SDL_AudioFormat format) {
+  switch (format) {
+    case AUDIO_U8:
+      return "u8";
+    case AUDIO_S8:
+      return "s8";
+    case AUDIO_S16SYS:
+      return "s16";
+    case AUDIO_S32SYS:
+      return "s32";
+    case AUDIO_F32SYS:
+      return "f32";
+    default:
+      return SDL_AUDIO_ISBIGENDIAN(format) ? "big-endian" : "other";
+  }
+}
+
+void pcm_convert_free(PcmConvert *c) {
+  av_freep(&c->remix_buf);
+  c->remix_buf_size = 0;
+}
@@ -0,0 +1,168 @@
+#include "pcm_interleave.h"
+
+extern "C" {
+#include <libavutil/cpu.h>
+}
+#include <string.h>
+
+#include "simd_dispatch.h"
+
+template <typename T>
+static void interleave_c_t(uint8_t *dst, const uint8_t *const *src,
+                           int channels, int start, int nb_samples) {
+  T *out = (T *)dst + (size_t)start * channels;
+  for (int i = start; i < nb_samples; i++) {
+    for (int ch = 0; ch < channels; ch++) {
+      *out++ = ((const T *)src[ch])[i];
+    }
+  }
+}
+
+static void interleave_tail(uint8_t *dst, const uint8_t *const *src,
+                            int channels, int start, int nb_samples,
+                            int sample_size) {
+  switch (sample_size) {
+    case 1:
+      interleave_c_t<uint8_t>(dst, src, channels, start, nb_samples);
+      break;
+    case 2:
+      interleave_c_t<uint16_t>(dst, src, channels, start, nb_samples);
+      break;
+    case 4:
+      interleave_c_t<uint32_t>(dst, src, channels, start, nb_samples);
+      break;
+    case 8:
+      interleave_c_t<uint64_t>(dst, src, channels, start, nb_samples);
+      break;
+  }
+}
+
+static void interleave_c(uint8_t *dst, const uint8_t *const *src,
+                         int channels, int nb_samples, int sample_size) {
+  if (channels == 1) {
+    memcpy(dst, src[0], (size_t)nb_samples * sample_size);
+    return;
+  }
+  interleave_tail(dst, src, channels, 0, nb_samples, sample_size);
+}
+
+#if SIMD_X86
+// Stereo: unpacking the low and high halves of L and R at the sample width
+// yields the interleaved pairs directly
+static void interleave_sse2(uint8_t *dst, const uint8_t *const *src,
+                            int channels, int nb_samples, int sample_size) {
+  if (channels != 2) {
+    interleave_c(dst, src, channels, nb_samples, sample_size);
+    return;
+  }
+  const uint8_t *l = src[0];
+  const uint8_t *r = src[1];
+  int step = 16 / sample_size;  // samples per register
+  int i = 0;
+
+  for (; i + step <= nb_samples; i += step) {
+    size_t in = (size_t)i * sample_size;
+    __m128i a = _mm_loadu_si128((const __m128i *)(l + in));
+    __m128i b = _mm_loadu_si128((const __m128i *)(r + in));
+    __m128i lo, hi;
+    switch (sample_size) {
+      case 1:
+        lo = _mm_unpacklo_epi8(a, b);
+        hi = _mm_unpackhi_epi8(a, b);
+        break;
+      case 2:
+        lo = _mm_unpacklo_epi16(a, b);
+        hi = _mm_unpackhi_epi16(a, b);
+        break;
+      case 4:
+        lo = _mm_unpacklo_epi32(a, b);
+        hi = _mm_unpackhi_epi32(a, b);
+        break;
+      default:
+        lo = _mm_unpacklo_epi64(a, b);
+        hi = _mm_unpackhi_epi64(a, b);
+        break;
+    }
+    _mm_storeu_si128((__m128i *)(dst + 2 * in), lo);
+    _mm_storeu_si128((__m128i *)(dst + 2 * in + 16), hi);
+  }
+  interleave_tail(dst, src, 2, i, nb_samples, sample_size);
+}
+#endif
+
+#if SIMD_TARGETS
+// Same as SSE2, but the 256-bit unpacks work per 128-bit lane, so the lane
+// halves are swapped back into order before storing
+TARGET_AVX2 static void interleave_avx2(uint8_t *dst,
+                                        const uint8_t *const *src,
+                                        int channels, int nb_samples,
+                                        int sample_size) {
+  if (channels != 2) {
+    interleave_c(dst, src, channels, nb_samples, sample_size);
+    return;
+  }
+  const uint8_t *l = src[0];
+  const uint8_t *r = src[1];
+  int step = 32 / sample_size;
+  int i = 0;
+
+  for (; i + step <= nb_samples; i += step) {
+    size_t in = (size_t)i * sample_size;
+    __m256i a = _mm256_loadu_si256((const __m256i *)(l + in));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(r + in));
+    __m256i lo, hi;
+    switch (sample_size) {
+      case 1:
+        lo = _mm256_unpacklo_epi8(a, b);
+        hi = _mm256_unpackhi_epi8(a, b);
+        break;
+      case 2:
+        lo = _mm256_unpacklo_epi16(a, b);
+        hi = _mm256_unpackhi_epi16(a, b);
+        break;
+      case 4:
+        lo = _mm256_unpacklo_epi32(a, b);
+        hi = _mm256_unpackhi_epi32(a, b);
+        break;
+      default:
+        lo = _mm256_unpacklo_epi64(a, b);
+        hi = _mm256_unpackhi_epi64(a, b);
+        break;
+    }
+    _mm256_storeu_si256((__m256i *)(dst + 2 * in),
+                        _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i *)(dst + 2 * in + 32),
+                        _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+  interleave_tail(dst, src, 2, i, nb_samples, sample_size);
+}
+#endif
+
+PcmInterleaveFunc pcm_interleave_get(int cpu_flags, const char **name) {
+  PcmInterleaveFunc func = interleave_c;
+  const char *func_name = "c";
+
+#if SIMD_X86
+  if (cpu_flags & AV_CPU_FLAG_SSE2) {
+    func = interleave_sse2;
+    func_name = "sse2";
+  }
+#endif
+#if SIMD_TARGETS
+  if (cpu_flags & AV_CPU_FLAG_AVX2) {
+    func = interleave_avx2;
+    func_name = "avx2";
+  }
+#endif
+  if (name) {
+    *name = func_name;
+  }
+  return func;
+}
+
+void pcm_interleave(uint8_t *dst, const uint8_t *const *src, int channels,
+                    int nb_samples, int sample_size) {
+  static const PcmInterleaveFunc func =
+      pcm_interleave_get(av_get_cpu_flags(), NULL);
+  func(dst, src, channels, nb_samples, sample_size);
+}
@@ -0,0 +1,280 @@
+#include "pcm_mixer.h"
+
+extern "C" {
+#include <libavutil/cpu.h>
+#include <libavutil/error.h>
+}
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "simd_dispatch.h"
+
+// The s16 scaling rounds like pmulhrsw (SSSE3, hence no SSE2 level) so all
+// kernels agree bit for bit
+static void mix_s16_tail(int16_t *dst, const int16_t *src, int start,
+                         int count, int gain) {
+  for (int i = start; i < count; i++) {
+    int v = gain >= PCM_MIXER_UNITY_Q15 ? src[i]
+                                        : (src[i] * gain + 16384) >> 15;
+    v += dst[i];
+    dst[i] = (int16_t)(v > INT16_MAX ? INT16_MAX
+                                     : v < INT16_MIN ? INT16_MIN : v);
+  }
+}
+
+static void mix_f32_tail(float *dst, const float *src, int start, int count,
+                         float gain) {
+  for (int i = start; i < count; i++) {
+    dst[i] += src[i] * gain;
+  }
+}
+
+static void clamp_f32_tail(float *dst, int start, int count) {
+  for (int i = start; i < count; i++) {
+    float v = dst[i];
+    dst[i] = v < -1.0f ? -1.0f : v > 1.0f ? 1.0f : v;
+  }
+}
+
+static void mix_s16_c(int16_t *dst, const int16_t *src, int count, int gain) {
+  mix_s16_tail(dst, src, 0, count, gain);
+}
+
+static void mix_f32_c(float *dst, const float *src, int count, float gain) {
+  mix_f32_tail(dst, src, 0, count, gain);
+}
+
+static void clamp_f32_c(float *dst, int count) {
+  clamp_f32_tail(dst, 0, count);
+}
+
+#if SIMD_TARGETS
+TARGET_SSSE3 static void mix_s16_ssse3(int16_t *dst, const int16_t *src,
+                                       int count, int gain) {
+  int i = 0;
+
+  if (gain >= PCM_MIXER_UNITY_Q15) {
+    for (; i + 8 <= count; i += 8) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epi16(d, x));
+    }
+  } else {
+    const __m128i g = _mm_set1_epi16((short)gain);
+    for (; i + 8 <= count; i += 8) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+      _mm_storeu_si128((__m128i *)(dst + i),
+                       _mm_adds_epi16(d, _mm_mulhrs_epi16(x, g)));
+    }
+  }
+  mix_s16_tail(dst, src, i, count, gain);
+}
+
+// Separate multiply and add, a fused one would round differently from the
+// scalar code
+static void mix_f32_sse(float *dst, const float *src, int count, float gain) {
+  const __m128 g = _mm_set1_ps(gain);
+  int i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(src + i), g);
+    _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), x));
+  }
+  mix_f32_tail(dst, src, i, count, gain);
+}
+
+static void clamp_f32_sse(float *dst, int count) {
+  const __m128 lo = _mm_set1_ps(-1.0f);
+  const __m128 hi = _mm_set1_ps(1.0f);
+  int i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128 v = _mm_loadu_ps(dst + i);
+    _mm_storeu_ps(dst + i, _mm_min_ps(_mm_max_ps(v, lo), hi));
+  }
+  clamp_f32_tail(dst, i, count);
+}
+
+TARGET_AVX2 static void mix_s16_avx2(int16_t *dst, const int16_t *src,
+                                     int count, int gain) {
+  int i = 0;
+
+  if (gain >= PCM_MIXER_UNITY_Q15) {
+    for (; i + 16 <= count; i += 16) {
+      __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+      __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+      _mm256_storeu_si256((__m256i *)(dst + i), _mm256_adds_epi16(d, x));
+    }
+  } else {
+    const __m256i g = _mm256_set1_epi16((short)gain);
+    for (; i + 16 <= count; i += 16) {
+      __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+      __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+      _mm256_storeu_si256((__m256i *)(dst + i),
+                          _mm256_adds_epi16(d, _mm256_mulhrs_epi16(x, g)));
+    }
+  }
+  mix_s16_tail(dst, src, i, count, gain);
+}
+
+TARGET_AVX2 static void mix_f32_avx2(float *dst, const float *src, int count,
+                                     float gain) {
+  const __m256 g = _mm256_set1_ps(gain);
+  int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_mul_ps(_mm256_loadu_ps(src + i), g);
+    _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), x));
+  }
+  mix_f32_tail(dst, src, i, count, gain);
+}
+
+TARGET_AVX2 static void clamp_f32_avx2(float *dst, int count) {
+  const __m256 lo = _mm256_set1_ps(-1.0f);
+  const __m256 hi = _mm256_set1_ps(1.0f);
+  int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256 v = _mm256_loadu_ps(dst + i);
+    _mm256_storeu_ps(dst + i, _mm256_min_ps(_mm256_max_ps(v, lo), hi));
+  }
+  clamp_f32_tail(dst, i, count);
+}
+#endif
+
+void pcm_mixer_get_kernels(int cpu_flags, PcmMixKernels *k) {
+  k->mix_s16 = mix_s16_c;
+  k->mix_f32 = mix_f32_c;
+  k->clamp_f32 = clamp_f32_c;
+  k->name = "c";
+#if SIMD_TARGETS
+  if (cpu_flags & AV_CPU_FLAG_SSSE3) {
+    k->mix_s16 = mix_s16_ssse3;
+    k->mix_f32 = mix_f32_sse;
+    k->clamp_f32 = clamp_f32_sse;
+    k->name = "ssse3";
+  }
+  if (cpu_flags & AV_CPU_FLAG_AVX2) {
+    k->mix_s16 = mix_s16_avx2;
+    k->mix_f32 = mix_f32_avx2;
+    k->clamp_f32 = clamp_f32_avx2;
+    k->name = "avx2";
+  }
+#endif
+}
+
+static float clamp_gain(float gain) {
+  return gain > 0.0f ? (gain < 1.0f ? gain : 1.0f) : 0.0f;
+}
+
+int pcm_mixer_init(PcmMixer *m, SDL_AudioFormat format, int channels,
+                   int cpu_flags) {
+  if (format != AUDIO_S16SYS && format != AUDIO_F32SYS) {
+    return AVERROR(ENOSYS);
+  }
+  m->format = format;
+  m->channels = channels;
+  m->frame_bytes = channels * SDL_AUDIO_BITSIZE(format) / 8;
+  pcm_mixer_get_kernels(cpu_flags, &m->kernels);
+  for (int i = 0; i < PCM_MIXER_MAX_STREAMS; i++) {
+    m->inputs[i].ring = NULL;
+    m->inputs[i].gain.store(0.0f);
+  }
+  m->nb_inputs.store(0);
+  m->mixes.store(0);
+  m->mix_ticks.store(0);
+  m->mix_ticks_max.store(0);
+  return 0;
+}
+
+int pcm_mixer_add(PcmMixer *m, AudioRing *ring, float gain) {
+  int n = m->nb_inputs.load(std::memory_order_relaxed);
+  if (n >= PCM_MIXER_MAX_STREAMS) {
+    return AVERROR(ENOSPC);
+  }
+  m->inputs[n].ring = ring;
+  m->inputs[n].gain.store(clamp_gain(gain), std::memory_order_relaxed);
+  // The callback only looks at inputs below the count it loads
+  m->nb_inputs.store(n + 1, std::memory_order_release);
+  return n;
+}
+
+void pcm_mixer_set_gain(PcmMixer *m, int index, float gain) {
+  m->inputs[index].gain.store(clamp_gain(gain), std::memory_order_relaxed);
+}
+
+static void mix_piece(PcmMixer *m, uint8_t *dst, const uint8_t *src,
+                      unsigned bytes, float gain) {
+  if (m->format == AUDIO_S16SYS) {
+    int q15 = (int)lrintf(gain * PCM_MIXER_UNITY_Q15);
+    m->kernels.mix_s16((int16_t *)dst, (const int16_t *)src, bytes / 2, q15);
+  } else {
+    m->kernels.mix_f32((float *)dst, (const float *)src, bytes / 4, gain);
+  }
+}
+
+void pcm_mixer_mix(PcmMixer *m, uint8_t *dst, int len) {
+  uint64_t start = SDL_GetPerformanceCounter();
+  int nb_inputs = m->nb_inputs.load(std::memory_order_acquire);
+  unsigned want = (unsigned)len - (unsigned)len % m->frame_bytes;
+
+  // Both formats are signed, all-zero bytes are silence
+  memset(dst, 0, len);
+  for (int i = 0; i < nb_inputs; i++) {
+    PcmMixerInput *in = &m->inputs[i];
+    const uint8_t *data1, *data2;
+    unsigned size1, size2;
+    unsigned n =
+        audio_ring_peek(in->ring, want, &data1, &size1, &data2, &size2);
+    float gain = in->gain.load(std::memory_order_relaxed);
+
+    // Ring positions stay sample aligned, so a wrap never splits a sample
+    if (gain > 0.0f) {
+      mix_piece(m, dst, data1, size1, gain);
+      mix_piece(m, dst + size1, data2, size2, gain);
+    }
+    audio_ring_consume(in->ring, n, want);
+  }
+  if (m->format == AUDIO_F32SYS) {
+    m->kernels.clamp_f32((float *)dst, want / 4);
+  }
+
+  // Only the callback writes these
+  uint64_t ticks = SDL_GetPerformanceCounter() - start;
+  m->mixes.fetch_add(1, std::memory_order_relaxed);
+  m->mix_ticks.fetch_add(ticks, std::memory_order_relaxed);
+  if (ticks > m->mix_ticks_max.load(std::memory_order_relaxed)) {
+    m->mix_ticks_max.store(ticks, std::memory_order_relaxed);
+  }
+}
+
+PcmMixerStats pcm_mixer_stats(PcmMixer *m) {
+  PcmMixerStats st;
+  double us_per_tick = 1e6 / SDL_GetPerformanceFrequency();
+
+  st.inputs = m->nb_inputs.load(std::memory_order_acquire);
+  st.mixes = m->mixes.load(std::memory_order_relaxed);
+  st.mix_avg_us = st.mixes ? m->mix_ticks.load(std::memory_order_relaxed) *
+                                 us_per_tick / st.mixes
+                           : 0.0;
+  st.mix_max_us =
+      m->mix_ticks_max.load(std::memory_order_relaxed) * us_per_tick;
+  st.underruns = 0;
+  for (int i = 0; i < st.inputs; i++) {
+    st.underruns += audio_ring_stats(m->inputs[i].ring).underruns;
+  }
+  return st;
+}
+
+void pcm_mixer_print_stats(PcmMixer *m) {
+  PcmMixerStats st = pcm_mixer_stats(m);
+
+  fprintf(stderr,
+          "audio mixer (%s, %s): %d streams, %llu callbacks, mix avg %.1f us "
+          "max %.1f us, %llu underruns\n",
+          m->format == AUDIO_F32SYS ? "f32" : "s16", m->kernels.name,
+          st.inputs, (unsigned long long)st.mixes, st.mix_avg_us, st.mix_max_us,
+          (unsigned long long)st.underruns);
+}
@@ -0,0 +1,234 @@
+#include "pcm_stream.h"
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+#include <stdio.h>
+#include <string.h>
+
+#include "event_wait.h"
+
+// Poll interval while waiting for the initial fill
+#define PCM_STREAM_PREFILL_POLL_MS 1
+
+static int convert_and_queue(PcmStream *s, const uint8_t *data, int nb_frames) {
+  PcmConvert *c = s->convert;
+
+  while (nb_frames > 0) {
+    int n = nb_frames < s->convert_frames ? nb_frames : s->convert_frames;
+    int ret = pcm_convert_run(c, s->convert_buf, data, n);
+    if (ret < 0) {
+      return ret;
+    }
+    if ((ret = audio_ring_write_all(&s->ring, s->convert_buf,
+                                    n * c->dst_frame_bytes)) < 0) {
+      return ret;
+    }
+    data += n * c->src_frame_bytes;
+    nb_frames -= n;
+  }
+  return 0;
+}
+
+// Converts whole file frames only; a frame cut by the window boundary waits
+// in |carry| for the rest of its bytes
+static int queue_window(PcmStream *s, const uint8_t *data, size_t size) {
+  if (!s->convert_buf) {
+    // Blocks only this thread, the callback keeps draining meanwhile
+    return audio_ring_write_all(&s->ring, data, (unsigned)size);
+  }
+
+  int in_frame = s->convert->src_frame_bytes;
+  int ret;
+  if (s->carry_bytes) {
+    int n = in_frame - s->carry_bytes;
+    if ((size_t)n > size) {
+      n = (int)size;
+    }
+    memcpy(s->carry + s->carry_bytes, data, n);
+    s->carry_bytes += n;
+    data += n;
+    size -= n;
+    if (s->carry_bytes < in_frame) {
+      return 0;
+    }
+    s->carry_bytes = 0;
+    if ((ret = convert_and_queue(s, s->carry, 1)) < 0) {
+      return ret;
+    }
+  }
+
+  int nb_frames = (int)(size / in_frame);
+  if ((ret = convert_and_queue(s, data, nb_frames)) < 0) {
+    return ret;
+  }
+  s->carry_bytes = (int)(size - (size_t)nb_frames * in_frame);
+  memcpy(s->carry, data + (size_t)nb_frames * in_frame, s->carry_bytes);
+  return 0;
+}
+
+static int SDLCALL reader_thread(void *opaque) {
+  PcmStream *s = (PcmStream *)opaque;
+  uint64_t pass_bytes = 0;
+
+  for (;;) {
+    const uint8_t *data;
+    size_t size;
+    int ret = es_reader_next(&s->reader, &data, &size);
+    if (ret < 0) {
+      char err[AV_ERROR_MAX_STRING_SIZE];
+      av_strerror(ret, err, sizeof(err));
+      fprintf(stderr, "Error reading %s: %s\n", s->path, err);
+      break;
+    }
+    if (ret == 0) {
+      // An empty file would spin here forever
+      if (!s->loop || !pass_bytes) {
+        break;
+      }
+      es_reader_close(&s->reader);
+      if (es_reader_open(&s->reader, s->path, PCM_STREAM_READ_WINDOW,
+                         s->mode) < 0) {
+        break;
+      }
+      s->loops.fetch_add(1, std::memory_order_relaxed);
+      // A trailing partial frame is dropped so the next pass stays aligned
+      s->carry_bytes = 0;
+      pass_bytes = 0;
+      continue;
+    }
+
+    if ((ret = queue_window(s, data, size)) < 0) {
+      if (ret != AVERROR_EXIT) {
+        fprintf(stderr, "Error converting %s\n", s->path);
+        break;
+      }
+      return 0;
+    }
+    pass_bytes += size;
+  }
+
+  audio_ring_finish(&s->ring);
+  if (s->eof_event) {
+    event_wait_post(s->eof_event, 0);
+  }
+  return 0;
+}
+
+int pcm_stream_open(PcmStream *s, const char *path, EsReaderMode mode,
+                    int ring_size, int frame_bytes, PcmConvert *convert,
+                    Uint8 silence, int loop, Uint32 eof_event) {
+  int ret;
+
+  s->path = NULL;
+  s->mode = mode;
+  s->loop = loop;
+  s->frame_bytes = frame_bytes > 0 ? frame_bytes : 1;
+  s->silence = silence;
+  s->eof_event = eof_event;
+  s->convert = convert;
+  s->convert_buf = NULL;
+  s->convert_frames = 0;
+  s->carry_bytes = 0;
+  memset(&s->reader, 0, sizeof(s->reader));
+  s->reader.fd = -1;
+  s->thread = NULL;
+  s->ring.buf = NULL;
+  s->loops.store(0);
+
+  if (ring_size <= 0) {
+    ring_size = PCM_STREAM_DEFAULT_RING;
+  }
+  if (ring_size < PCM_STREAM_MIN_RING) {
+    ring_size = PCM_STREAM_MIN_RING;
+  }
+
+  s->path = SDL_strdup(path);
+  if (!s->path ||
+      audio_ring_init(&s->ring, ring_size, s->frame_bytes) < 0) {
+    pcm_stream_close(s);
+    return AVERROR(ENOMEM);
+  }
+
+  // One window's worth of frames per conversion batch
+  if (convert && !pcm_convert_is_passthrough(convert)) {
+    if (convert->src_frame_bytes > PCM_STREAM_MAX_FRAME) {
+      pcm_stream_close(s);
+      return AVERROR(EINVAL);
+    }
+    s->convert_frames = PCM_STREAM_READ_WINDOW / convert->src_frame_bytes + 1;
+    s->convert_buf = (uint8_t *)av_malloc((size_t)s->convert_frames *
+                                          convert->dst_frame_bytes);
+    if (!s->convert_buf) {
+      pcm_stream_close(s);
+      return AVERROR(ENOMEM);
+    }
+  }
+
+  if ((ret = es_reader_open(&s->reader, path, PCM_STREAM_READ_WINDOW, mode)) <
+      0) {
+    pcm_stream_close(s);
+    return ret;
+  }
+
+  s->thread = SDL_CreateThread(reader_thread, "pcm_reader", s);
+  if (!s->thread) {
+    fprintf(stderr, "Could not create reader thread: %s\n", SDL_GetError());
+    pcm_stream_close(s);
+    return AVERROR(ENOMEM);
+  }
+
+  // Half a ring is enough to start; the rest fills while playing
+  while (audio_ring_fill(&s->ring) < s->ring.capacity / 2 &&
+         !s->ring.finished.load(std::memory_order_acquire)) {
+    SDL_Delay(PCM_STREAM_PREFILL_POLL_MS);
+  }
+  return 0;
+}
+
+int pcm_stream_read(PcmStream *s, uint8_t *dst, int len) {
+  return (int)audio_ring_read(&s->ring, dst, len, s->silence);
+}
+
+int pcm_stream_finished(PcmStream *s) {
+  return s->ring.finished.load(std::memory_order_acquire) &&
+         audio_ring_fill(&s->ring) < (unsigned)s->frame_bytes;
+}
+
+PcmStreamStats pcm_stream_stats(PcmStream *s) {
+  PcmStreamStats st;
+
+  st.loops = s->loops.load(std::memory_order_relaxed);
+  st.ring = audio_ring_stats(&s->ring);
+  return st;
+}
+
+void pcm_stream_print_stats(PcmStream *s) {
+  PcmStreamStats st = pcm_stream_stats(s);
+
+  fprintf(stderr,
+          "pcm stream (%s): %.1f MB read, %llu loops, ring %u KB "
+          "(%u KB queued, low %u KB), %llu callbacks, %llu underruns "
+          "(%llu bytes of silence), %llu full waits\n",
+          es_reader_mode_name(s->mode), st.ring.written / 1048576.0,
+          (unsigned long long)st.loops, st.ring.capacity >> 10,
+          st.ring.fill >> 10, st.ring.min_fill >> 10,
+          (unsigned long long)st.ring.reads,
+          (unsigned long long)st.ring.underruns,
+          (unsigned long long)st.ring.underrun_bytes,
+          (unsigned long long)st.ring.overruns);
+}
+
+void pcm_stream_close(PcmStream *s) {
+  if (s->thread) {
+    audio_ring_abort(&s->ring);
+    SDL_WaitThread(s->thread, NULL);
+    s->thread = NULL;
+  }
+  es_reader_close(&s->reader);
+  audio_ring_destroy(&s->ring);
+  av_freep(&s->convert_buf);
+  SDL_free(s->path);
+  s->path = NULL;
+}
@@ -1,4 +1,5 @@
 #include "sdl2_test.h"
+#include "frame_pacer.h"
 
 #include <SDL2/SDL_config.h>
 #include <SDL2/SDL_test_common.h>
@@ -1358,6 +1359,43 @@ long getFileSize(FILE *file) {
   return size;
 }
 
+// Y4Mļͷ "YUV4MPEG2 W1280 H720 F25:1 Ip A1:1 C420jpeg", ɹʱ
+// һ֡λ; Y4Mļ0, ʽַ֧-1
+long readY4mHeader(FILE *file, long *width, long *height, double *fps) {
+  char header[256];
+  if (!fgets(header, sizeof(header), file) ||
+      strncmp(header, "YUV4MPEG2 ", 10) != 0) {
+    fseek(file, 0, SEEK_SET);
+    return 0;
+  }
+  for (char *tok = strtok(header + 10, " \n"); tok;
+       tok = strtok(NULL, " \n")) {
+    int num, den;
+    if (tok[0] == 'W') {
+      *width = atol(tok + 1);
+    } else if (tok[0] == 'H') {
+      *height = atol(tok + 1);
+    } else if (tok[0] == 'F' && sscanf(tok + 1, "%d:%d", &num, &den) == 2 &&
+               num > 0 && den > 0) {
+      *fps = (double)num / den;
+    } else if (tok[0] == 'C' && (strncmp(tok + 1, "420", 3) != 0 ||
+                                 strstr(tok + 1, "p1"))) {
+      // 8bitIYUV, ֻܲ8bit 4:2:0
+      fprintf(stderr, "Unsupported Y4M colour space %s\n", tok + 1);
+      return -1;
+    }
+  }
+  return ftell(file);
+}
+
+// Y4Mÿ֡ǰ "FRAME...\n"
+int skipY4mFrameHeader(FILE *file) {
+  int c;
+  while ((c = fgetc(file)) != EOF && c != '\n') {
+  }
+  return c == EOF ? -1 : 0;
+}
+
 int main(int argc, char **argv) {
   // ʼSDL
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
@@ -1365,6 +1403,25 @@ int main(int argc, char **argv) {
     return -1;
   }
 
+  // YUVļ, Y4Mļļͷȡߺ֡, YUV1280x720 25fps
+  const char *yuvFileName = argc > 1 ? argv[1] : "output.yuv";
+  FILE *yuvFile = fopen(yuvFileName, "rb");
+  if (yuvFile == NULL) {
+    fprintf(stderr, "Failed to open YUV file\n");
+    SDL_Quit();
+    return -1;
+  }
+  long width = 1280;
+  long height = 720;
+  double fps = 25;
+  long dataStart = readY4mHeader(yuvFile, &width, &height, &fps);
+  if (dataStart < 0) {
+    fclose(yuvFile);
+    SDL_Quit();
+    return -1;
+  }
+  int isY4m = dataStart > 0;
+
   // 
   SDL_Window *window =
       SDL_CreateWindow("YUV Player", SDL_WINDOWPOS_UNDEFINED,
@@ -1386,8 +1443,9 @@ int main(int argc, char **argv) {
   }
 
   // 
-  SDL_Texture *texture = SDL_CreateTexture(
-      renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STATIC, 1280, 720);
+  SDL_Texture *texture =
+      SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV,
+                        SDL_TEXTUREACCESS_STATIC, width, height);
   if (texture == NULL) {
     fprintf(stderr, "Texture creation failed: %s\n", SDL_GetError());
     SDL_DestroyRenderer(renderer);
@@ -1396,21 +1454,7 @@ int main(int argc, char **argv) {
     return -1;
   }
 
-  // YUVļ
-  FILE *yuvFile = fopen("output.yuv", "rb");
-  if (yuvFile == NULL) {
-    fprintf(stderr, "Failed to open YUV file\n");
-    SDL_DestroyTexture(texture);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
-    return -1;
-  }
-
-  // ȡļС㵥֡С
-  long fileSize = getFileSize(yuvFile);
-  long width = 1280;
-  long height = 720;
+  // 㵥֡С
   long frameSize = width * height * 3 / 2;  // For YUV420 (YV12)
 
   // ڴȡYUV֡
@@ -1425,15 +1469,22 @@ int main(int argc, char **argv) {
     return -1;
   }
 
+  FramePacer pacer;
+  frame_pacer_init(&pacer, FRAME_PACER_DEFAULT_SPIN);
+  double next_frame = frame_pacer_now();
+
   SDL_Event event;
   int isRunning = 1;
   while (isRunning) {
     // ȡһ֡
+    if (isY4m) {
+      skipY4mFrameHeader(yuvFile);
+    }
     size_t bytesRead = fread(yuvFrameData, 1, frameSize, yuvFile);
     if (bytesRead != frameSize) {
       if (feof(yuvFile)) {
         // Ѿļѡ»صļͷ
-        fseek(yuvFile, 0, SEEK_SET);
+        fseek(yuvFile, dataStart, SEEK_SET);
       } else {
         fprintf(stderr, "Failed to read a complete frame\n");
         break;
@@ -1456,10 +1507,13 @@ int main(int argc, char **argv) {
     }
 
     // ֡
-    SDL_Delay(40);  // ÿ֡ȴ40msƴԼ25fps
+    next_frame += 1.0 / fps;
+    frame_pacer_wait_until(&pacer, next_frame);
   }
 
   // Դ
+  frame_pacer_print_stats(&pacer);
+
   free(yuvFrameData);
   fclose(yuvFile);
   SDL_DestroyTexture(texture);
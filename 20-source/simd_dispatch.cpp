@@ -0,0 +1,28 @@
+#include "simd_dispatch.h"
+
+extern "C" {
+#include <libavutil/cpu.h>
+}
+#include <string.h>
+
+int simd_bench_levels(SimdKernelName kernel_name,
+                      int flags[SIMD_MAX_LEVELS]) {
+  // Each level adds one extension; a kernel family that has nothing new for
+  // it picks the same kernel as the level before and is skipped
+  static const int kLevels[SIMD_MAX_LEVELS] = {
+      0, AV_CPU_FLAG_SSE2, AV_CPU_FLAG_SSE2 | AV_CPU_FLAG_SSSE3,
+      AV_CPU_FLAG_SSE2 | AV_CPU_FLAG_SSSE3 | AV_CPU_FLAG_AVX2};
+  const int cpu_flags = av_get_cpu_flags();
+  const char *last = NULL;
+  int count = 0;
+
+  for (int i = 0; i < SIMD_MAX_LEVELS; i++) {
+    const char *name = kernel_name(kLevels[i] & cpu_flags);
+    if (last && !strcmp(name, last)) {
+      continue;
+    }
+    last = name;
+    flags[count++] = kLevels[i] & cpu_flags;
+  }
+  return count;
+}
@@ -2,12 +2,17 @@
 #include <SDL2/SDL_config.h>
 
 #include <cstdlib>
+#include <cstring>
+
+#include "event_wait.h"
+#include "latency_tuner.h"
 
 static struct {
   SDL_AudioSpec spec;
   Uint8* sound;    /* Pointer to wave data*/
   Uint32 soundLen; /* Length of wave data*/
   int soundpos;    /* Current play position*/
+  LatencyTuner tuner; /* Callback timing, picks the device period*/
 } wave;
 
 static SDL_AudioDeviceID device;
@@ -25,13 +30,15 @@ static void close_audio(void) {
 }
 
 static void open_audio(void) {
-  device = SDL_OpenAudioDevice(NULL, SDL_FALSE, &wave.spec, NULL, 0);
+  SDL_AudioSpec obtained;
+  device = SDL_OpenAudioDevice(NULL, SDL_FALSE, &wave.spec, &obtained, 0);
   if (!device) {
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't opne audio: %s\n",
                  SDL_GetError());
     SDL_FreeWAV(wave.sound);
     quit(2);
   }
+  latency_tuner_set_period(&wave.tuner, obtained.freq, obtained.samples);
   SDL_PauseAudioDevice(device, SDL_FALSE);
 }
 
@@ -39,6 +46,8 @@ void SDLCALL fillerup(void* unused, Uint8* stream, int len) {
   Uint8* waveptr;
   int waveleft;
 
+  latency_tuner_on_callback(&wave.tuner);
+
   /* set up the pointers */
   waveptr = wave.sound + wave.soundpos;
   waveleft = wave.soundLen - wave.soundpos;
@@ -110,6 +119,19 @@ char* GetResourceFilename(const char* user_specified, const char* def) {
   }
 }
 
+/* wave.spec leaves the rate to SDL, which only reports it for an open
+ * device; a paused one never calls back, so opening it once is harmless */
+static int probe_rate(void) {
+  SDL_AudioSpec obtained;
+  SDL_AudioDeviceID probe =
+      SDL_OpenAudioDevice(NULL, SDL_FALSE, &wave.spec, &obtained, 0);
+  if (!probe) {
+    return 0; /* open_audio reports the error */
+  }
+  SDL_CloseAudioDevice(probe);
+  return obtained.freq;
+}
+
 static void reopen_audio(void) {
   close_audio();
   open_audio();
@@ -118,6 +140,12 @@ static void reopen_audio(void) {
 int main(int argc, char* argv[]) {
   int i;
   char* filename = NULL;
+  const char* user_file = NULL;
+  int samples = 4096;
+  int low_latency = 0;
+  int target_ms = 20;
+  int seconds = 0;
+  EventWait waiter;
   SDL_setenv("SDL_AUDIODRIVER", "alsa", 0);
 
   /* Enable standard application logging */
@@ -130,7 +158,26 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  filename = GetResourceFilename(argc > 1 ? argv[1] : NULL, "sample.wav");
+  for (i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+      samples = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--low-latency")) {
+      low_latency = 1;
+    } else if (!strcmp(argv[i], "--target-ms") && i + 1 < argc) {
+      target_ms = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      seconds = atoi(argv[++i]);
+    } else {
+      user_file = argv[i];
+    }
+  }
+  if (samples <= 0 || samples > 65535 || target_ms <= 0) {
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "Invalid --samples or --target-ms\n");
+    quit(1);
+  }
+
+  filename = GetResourceFilename(user_file, "sample.wav");
 
   /** Read file  */
   SDL_RWops* src = SDL_RWFromFile(filename, "rb");
@@ -162,8 +209,14 @@ int main(int argc, char* argv[]) {
   wave.spec.userdata = nullptr;
   wave.spec.format = AUDIO_S16LSB;
   wave.spec.channels = 2;
-  wave.spec.samples = 4096;
+  wave.spec.samples = samples;
   wave.spec.callback = fillerup;
+  /* the data is all in memory and never runs dry, so in low-latency mode
+   * only callback jitter moves the period. Sizing the first period needs
+   * the rate; open_audio hands the tuner the one the device really got */
+  wave.spec.samples =
+      latency_tuner_init(&wave.tuner, low_latency ? probe_rate() : 0, samples,
+                         target_ms, low_latency);
 
   /** show the list of available driver */
   SDL_Log("Avaliable audio drivers;");
@@ -176,10 +229,22 @@ int main(int argc, char* argv[]) {
   open_audio();
 
   SDL_FlushEvents(SDL_AUDIODEVICEADDED, SDL_AUDIODEVICEREMOVED);
+  if (event_wait_init(&waiter) < 0) {
+    SDL_OutOfMemory();
+    quit(1);
+  }
 
+  Uint32 start_ticks = SDL_GetTicks();
   while (!done) {
     SDL_Event event;
-    while (SDL_PollEvent(&event) > 0) {
+    /* nothing to do between events but the tuner window and --seconds */
+    int timeout = -1;
+    event_wait_until(&timeout, latency_tuner_deadline(&wave.tuner));
+    if (seconds > 0) {
+      event_wait_until(&timeout, start_ticks + (Uint32)seconds * 1000);
+    }
+    int have_event = event_wait(&waiter, &event, timeout);
+    for (; have_event; have_event = SDL_PollEvent(&event)) {
       if (event.type == SDL_QUIT) {
         done = 1;
       }
@@ -189,10 +254,21 @@ int main(int argc, char* argv[]) {
         reopen_audio();
       }
     }
-    SDL_Delay(100);
+    if (seconds > 0 && SDL_GetTicks() - start_ticks >= (Uint32)seconds * 1000) {
+      done = 1;
+    }
+    int new_samples = latency_tuner_update(&wave.tuner, 0);
+    if (new_samples) {
+      SDL_Log("period %d -> %d samples", wave.spec.samples, new_samples);
+      wave.spec.samples = new_samples;
+      reopen_audio();
+    }
   }
 
   close_audio();
+  event_wait_print_stats(&waiter, "main loop");
+  event_wait_close(&waiter);
+  latency_tuner_print_stats(&wave.tuner);
   SDL_free(filename);
   SDL_Quit();
   return 0;
@@ -0,0 +1,457 @@
+#include "yuv_writer.h"
+
+extern "C" {
+#include <libavutil/avstring.h>
+#include <libavutil/error.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+#include <libavutil/version.h>
+}
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static const char *kModeNames[] = {"buffered", "direct", "writev"};
+static const char *kFormatNames[] = {"raw", "nv12", "y4m"};
+static const char kY4mFrameMarker[] = "FRAME\n";
+
+const char *yuv_writer_mode_name(YuvWriterMode mode) {
+  return kModeNames[mode];
+}
+
+int yuv_writer_parse_mode(const char *name, YuvWriterMode *mode) {
+  for (int i = 0; i < (int)(sizeof(kModeNames) / sizeof(kModeNames[0]));
+       i++) {
+    if (!strcmp(name, kModeNames[i])) {
+      *mode = (YuvWriterMode)i;
+      return 0;
+    }
+  }
+  fprintf(stderr, "Unknown output mode '%s', expected buffered|direct|writev\n",
+          name);
+  return AVERROR(EINVAL);
+}
+
+static int write_all(YuvWriter *w, const uint8_t *buf, size_t size) {
+  int64_t start = av_gettime_relative();
+
+  while (size > 0) {
+    ssize_t n = write(w->fd, buf, size);
+    w->syscalls++;
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int err = AVERROR(errno);
+      fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+      return err;
+    }
+    buf += n;
+    size -= n;
+  }
+  w->write_us += av_gettime_relative() - start;
+  return 0;
+}
+
+static int flush_iov(YuvWriter *w) {
+  struct iovec *iov = w->iov;
+  int count = w->iov_count;
+  int64_t start = av_gettime_relative();
+
+  w->iov_count = 0;
+  while (count > 0) {
+    ssize_t n = writev(w->fd, iov, count);
+    w->syscalls++;
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int err = AVERROR(errno);
+      fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+      return err;
+    }
+    // Skip what went out, a short write may stop in the middle of an iovec
+    while (count > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  w->write_us += av_gettime_relative() - start;
+  return 0;
+}
+
+static int append_rows(YuvWriter *w, const uint8_t *src, int linesize,
+                       size_t row_bytes, int rows) {
+  int ret;
+
+  if (w->mode == YUV_WRITER_WRITEV) {
+    // A tightly packed plane is one contiguous range
+    if ((size_t)linesize == row_bytes) {
+      row_bytes *= rows;
+      rows = 1;
+    }
+    for (int y = 0; y < rows; y++) {
+      if (w->iov_count == YUV_WRITER_MAX_IOV && (ret = flush_iov(w)) < 0) {
+        return ret;
+      }
+      w->iov[w->iov_count].iov_base = (void *)(src + (ptrdiff_t)y * linesize);
+      w->iov[w->iov_count].iov_len = row_bytes;
+      w->iov_count++;
+    }
+    return 0;
+  }
+
+  for (int y = 0; y < rows; y++) {
+    const uint8_t *row = src + (ptrdiff_t)y * linesize;
+    size_t left = row_bytes;
+    while (left > 0) {
+      size_t chunk = YUV_WRITER_BLOCK_SIZE - w->block_used;
+      if (chunk > left) {
+        chunk = left;
+      }
+      memcpy(w->block + w->block_used, row, chunk);
+      w->block_used += chunk;
+      row += chunk;
+      left -= chunk;
+      if (w->block_used == YUV_WRITER_BLOCK_SIZE) {
+        if ((ret = write_all(w, w->block, w->block_used)) < 0) {
+          return ret;
+        }
+        w->block_used = 0;
+      }
+    }
+  }
+  return 0;
+}
+
+int yuv_writer_parse_format(const char *name, YuvWriterFormat *format) {
+  for (int i = 0; i < (int)(sizeof(kFormatNames) / sizeof(kFormatNames[0]));
+       i++) {
+    if (!strcmp(name, kFormatNames[i])) {
+      *format = (YuvWriterFormat)i;
+      return 0;
+    }
+  }
+  fprintf(stderr, "Unknown output format '%s', expected raw|nv12|y4m\n",
+          name);
+  return AVERROR(EINVAL);
+}
+
+// Y4M colour space tag for the formats the container can describe
+static const char *y4m_colorspace(const AVFrame *frame) {
+  switch (frame->format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+      return frame->chroma_location == AVCHROMA_LOC_LEFT ? "420mpeg2"
+                                                         : "420jpeg";
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+      return "422";
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+      return "444";
+    case AV_PIX_FMT_GRAY8:
+      return "mono";
+    case AV_PIX_FMT_YUV420P10LE:
+      return "420p10";
+    case AV_PIX_FMT_YUV422P10LE:
+      return "422p10";
+    case AV_PIX_FMT_YUV444P10LE:
+      return "444p10";
+    default:
+      return NULL;
+  }
+}
+
+static int is_keyframe(const AVFrame *frame) {
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(58, 7, 100)
+  return !!(frame->flags & AV_FRAME_FLAG_KEY);
+#else
+  return frame->key_frame;
+#endif
+}
+
+void yuv_writer_options_default(YuvWriterOptions *opts) {
+  memset(opts, 0, sizeof(*opts));
+  opts->format = YUV_WRITER_FORMAT_RAW;
+  opts->time_base = av_make_q(1, AV_TIME_BASE);
+  opts->stream_header = 1;
+}
+
+int yuv_writer_open(YuvWriter *w, const char *path, YuvWriterMode mode) {
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+  memset(w, 0, sizeof(*w));
+  w->mode = mode;
+  w->fd = -1;
+  yuv_writer_options_default(&w->opts);
+
+#ifdef O_DIRECT
+  if (mode == YUV_WRITER_DIRECT) {
+    w->fd = open(path, flags | O_DIRECT, 0644);
+    if (w->fd < 0 && errno == EINVAL) {
+      fprintf(stderr, "O_DIRECT not supported for %s, using buffered output\n",
+              path);
+      w->mode = YUV_WRITER_BUFFERED;
+    }
+  }
+#else
+  if (mode == YUV_WRITER_DIRECT) {
+    w->mode = YUV_WRITER_BUFFERED;
+  }
+#endif
+  if (w->fd < 0) {
+    w->fd = open(path, flags, 0644);
+  }
+  if (w->fd < 0) {
+    fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+    return AVERROR(errno);
+  }
+
+  if (w->mode == YUV_WRITER_WRITEV) {
+    w->iov = (struct iovec *)av_malloc_array(YUV_WRITER_MAX_IOV,
+                                             sizeof(*w->iov));
+  } else {
+    // av_malloc only aligns for SIMD, O_DIRECT wants sector alignment
+    void *block = NULL;
+    if (posix_memalign(&block, YUV_WRITER_ALIGN, YUV_WRITER_BLOCK_SIZE) == 0) {
+      w->block = (uint8_t *)block;
+    }
+  }
+  if (!w->iov && !w->block) {
+    close(w->fd);
+    w->fd = -1;
+    return AVERROR(ENOMEM);
+  }
+  return 0;
+}
+
+int yuv_writer_configure(YuvWriter *w, const YuvWriterOptions *opts) {
+  w->opts = *opts;
+  w->opts.index_path = NULL;
+  if (opts->index_path) {
+    w->index = fopen(opts->index_path, "wb");
+    if (!w->index) {
+      fprintf(stderr, "Could not open %s: %s\n", opts->index_path,
+              strerror(errno));
+      return AVERROR(errno);
+    }
+  }
+  return 0;
+}
+
+// Stream header and index header, both need the first frame's geometry
+static int write_headers(YuvWriter *w, const AVFrame *frame,
+                         enum AVPixelFormat out_fmt) {
+  int ret;
+
+  if (w->opts.format == YUV_WRITER_FORMAT_Y4M && w->opts.stream_header) {
+    const char *colorspace = y4m_colorspace(frame);
+    AVRational fps = w->opts.frame_rate.num > 0 && w->opts.frame_rate.den > 0
+                         ? w->opts.frame_rate
+                         : av_make_q(25, 1);
+    AVRational sar = w->opts.sample_aspect_ratio;
+    char header[128];
+
+    if (!colorspace) {
+      fprintf(stderr, "Pixel format %s cannot be stored in Y4M\n",
+              av_get_pix_fmt_name((enum AVPixelFormat)frame->format));
+      return AVERROR(EINVAL);
+    }
+    int len = snprintf(header, sizeof(header),
+                       "YUV4MPEG2 W%d H%d F%d:%d Ip A%d:%d C%s\n",
+                       frame->width, frame->height, fps.num, fps.den,
+                       sar.num > 0 ? sar.num : 0, sar.num > 0 ? sar.den : 0,
+                       colorspace);
+    // Written on its own, the writev path must not point into |header|
+    if (w->mode == YUV_WRITER_WRITEV) {
+      ret = write_all(w, (const uint8_t *)header, len);
+    } else {
+      ret = append_rows(w, (const uint8_t *)header, len, len, 1);
+    }
+    if (ret < 0) {
+      return ret;
+    }
+    w->offset += len;
+  }
+
+  if (w->index) {
+    YuvIndexHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, YUV_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.width = frame->width;
+    hdr.height = frame->height;
+    av_strlcpy(hdr.pix_fmt, av_get_pix_fmt_name(out_fmt),
+               sizeof(hdr.pix_fmt));
+    hdr.time_base_num = w->opts.time_base.num;
+    hdr.time_base_den = w->opts.time_base.den;
+    hdr.entry_size = sizeof(YuvIndexEntry);
+    if (fwrite(&hdr, sizeof(hdr), 1, w->index) != 1) {
+      return AVERROR(EIO);
+    }
+  }
+  return 0;
+}
+
+// Interleave the U and V planes of a 4:2:0 frame into NV12's chroma plane
+static int append_nv12_chroma(YuvWriter *w, const AVFrame *frame) {
+  int cw = AV_CEIL_RSHIFT(frame->width, 1);
+  int ch = AV_CEIL_RSHIFT(frame->height, 1);
+  size_t row_bytes = (size_t)cw * 2;
+
+  av_fast_malloc(&w->nv12_chroma, &w->nv12_chroma_size, row_bytes * ch);
+  if (!w->nv12_chroma) {
+    return AVERROR(ENOMEM);
+  }
+  for (int y = 0; y < ch; y++) {
+    const uint8_t *u = frame->data[1] + (ptrdiff_t)y * frame->linesize[1];
+    const uint8_t *v = frame->data[2] + (ptrdiff_t)y * frame->linesize[2];
+    uint8_t *dst = w->nv12_chroma + y * row_bytes;
+    for (int x = 0; x < cw; x++) {
+      dst[2 * x] = u[x];
+      dst[2 * x + 1] = v[x];
+    }
+  }
+  w->bytes += row_bytes * ch;
+  return append_rows(w, w->nv12_chroma, (int)row_bytes, row_bytes, ch);
+}
+
+int yuv_writer_write_frame(YuvWriter *w, const AVFrame *frame) {
+  const AVPixFmtDescriptor *desc =
+      av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+  enum AVPixelFormat out_fmt = (enum AVPixelFormat)frame->format;
+  int row_bytes[4];
+  int ret;
+
+  if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL) ||
+      av_image_fill_linesizes(row_bytes, (enum AVPixelFormat)frame->format,
+                              frame->width) < 0) {
+    fprintf(stderr, "Unsupported pixel format %d\n", frame->format);
+    return AVERROR(EINVAL);
+  }
+
+  int nv12 = 0;
+  if (w->opts.format == YUV_WRITER_FORMAT_NV12 &&
+      out_fmt != AV_PIX_FMT_NV12) {
+    if (out_fmt != AV_PIX_FMT_YUV420P && out_fmt != AV_PIX_FMT_YUVJ420P) {
+      fprintf(stderr, "NV12 output needs 8-bit 4:2:0 input, got %s\n",
+              av_get_pix_fmt_name(out_fmt));
+      return AVERROR(EINVAL);
+    }
+    nv12 = 1;
+    out_fmt = AV_PIX_FMT_NV12;
+  }
+
+  if (!w->header_written) {
+    if ((ret = write_headers(w, frame, out_fmt)) < 0) {
+      return ret;
+    }
+    w->header_written = 1;
+  }
+  if (w->opts.format == YUV_WRITER_FORMAT_Y4M) {
+    int len = sizeof(kY4mFrameMarker) - 1;
+    ret = append_rows(w, (const uint8_t *)kY4mFrameMarker, len, len, 1);
+    if (ret < 0) {
+      return ret;
+    }
+    w->offset += len;
+  }
+
+  uint64_t start = w->bytes;
+  int planes = av_pix_fmt_count_planes((enum AVPixelFormat)frame->format);
+  for (int i = 0; i < planes; i++) {
+    if (nv12 && i == 1) {
+      if ((ret = append_nv12_chroma(w, frame)) < 0) {
+        return ret;
+      }
+      break;
+    }
+    // Only the chroma planes are subsampled, alpha is full height
+    int rows = (i == 1 || i == 2)
+                   ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h)
+                   : frame->height;
+    ret = append_rows(w, frame->data[i], frame->linesize[i], row_bytes[i],
+                      rows);
+    if (ret < 0) {
+      return ret;
+    }
+    w->bytes += (uint64_t)row_bytes[i] * rows;
+  }
+  w->frames++;
+
+  uint64_t size = w->bytes - start;
+  if (w->index) {
+    YuvIndexEntry entry;
+    entry.offset = w->offset;
+    entry.pts = frame->best_effort_timestamp != AV_NOPTS_VALUE
+                    ? frame->best_effort_timestamp
+                    : frame->pts;
+    entry.size = (uint32_t)size;
+    entry.flags = is_keyframe(frame) ? YUV_INDEX_KEYFRAME : 0;
+    if (fwrite(&entry, sizeof(entry), 1, w->index) != 1) {
+      return AVERROR(EIO);
+    }
+  }
+  w->offset += size;
+
+  // The frame's buffers are only borrowed until the caller unrefs it
+  if (w->mode == YUV_WRITER_WRITEV && w->iov_count > 0) {
+    return flush_iov(w);
+  }
+  return 0;
+}
+
+int yuv_writer_close(YuvWriter *w) {
+  int ret = 0;
+
+  if (w->fd < 0) {
+    return 0;
+  }
+  if (w->block_used > 0) {
+#ifdef O_DIRECT
+    // O_DIRECT needs whole sectors, the unaligned tail goes through the
+    // page cache
+    if (w->mode == YUV_WRITER_DIRECT) {
+      fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+    }
+#endif
+    ret = write_all(w, w->block, w->block_used);
+    w->block_used = 0;
+  }
+  if (close(w->fd) < 0 && ret == 0) {
+    ret = AVERROR(errno);
+  }
+  w->fd = -1;
+  free(w->block);
+  w->block = NULL;
+  av_freep(&w->iov);
+  av_freep(&w->nv12_chroma);
+  if (w->index) {
+    if (fclose(w->index) != 0 && ret == 0) {
+      ret = AVERROR(EIO);
+    }
+    w->index = NULL;
+  }
+  return ret;
+}
+
+void yuv_writer_print_stats(const YuvWriter *w) {
+  double seconds = w->write_us / 1e6;
+  fprintf(stderr,
+          "Output (%s): %llu frames, %.1f MB in %llu write calls, "
+          "%.1f MB/s while writing\n",
+          yuv_writer_mode_name(w->mode), (unsigned long long)w->frames,
+          w->bytes / (1024.0 * 1024.0), (unsigned long long)w->syscalls,
+          seconds > 0 ? w->bytes / seconds / (1024.0 * 1024.0) : 0.0);
+}